@@ -1,25 +1,84 @@
 #pragma once
+#include <brpc/callback.h>
 #include <brpc/channel.h>
 
 #include <list>
 
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 namespace huzch {
 
+// 带指标的信道，按下游服务统计调用耗时与失败数，同步与异步调用均适用
+// 处于请求上下文中时为调用建立子 span，span id 经 log_id 传给下游；
+// 请求的 request_id 由调用方填写，信道不修改请求
+class MeteredChannel : public google::protobuf::RpcChannel {
+ public:
+  MeteredChannel(CallMetric& metric) : _metric(metric) {}
+
+  int Init(const char* host, const brpc::ChannelOptions* options) {
+    return _channel.Init(host, options);
+  }
+
+  void CallMethod(const google::protobuf::MethodDescriptor* method,
+                  google::protobuf::RpcController* controller,
+                  const google::protobuf::Message* request,
+                  google::protobuf::Message* response,
+                  google::protobuf::Closure* done) override {
+    auto ctrl = static_cast<brpc::Controller*>(controller);
+    std::unique_ptr<Span> span;
+    Span* parent = Span::current();
+    if (parent && parent->enabled()) {
+      span = std::make_unique<Span>(method->full_name(), parent);
+      ctrl->set_log_id(span->id());
+    }
+
+    if (done) {
+      done = brpc::NewCallback(&MeteredChannel::on_done, &_metric,
+                               span.release(), ctrl, done);
+      _channel.CallMethod(method, controller, request, response, done);
+      return;
+    }
+    _channel.CallMethod(method, controller, request, response, nullptr);
+    _metric.record(ctrl->latency_us(), !ctrl->Failed());
+    if (span && ctrl->Failed()) {
+      span->fail();
+    }
+  }
+
+ private:
+  static void on_done(CallMetric* metric, Span* span, brpc::Controller* ctrl,
+                      google::protobuf::Closure* done) {
+    metric->record(ctrl->latency_us(), !ctrl->Failed());
+    if (span) {
+      if (ctrl->Failed()) {
+        span->fail();
+      }
+      delete span;
+    }
+    done->Run();
+  }
+
+ private:
+  CallMetric& _metric;
+  brpc::Channel _channel;
+};
+
 // 服务信道管理(管理一个服务对应的所有信道)
 class ServiceChannel {
  public:
   using Ptr = std::shared_ptr<ServiceChannel>;
-  using ChannelPtr = std::shared_ptr<brpc::Channel>;
+  using ChannelPtr = std::shared_ptr<MeteredChannel>;
   using ListIt = std::list<ChannelPtr>::iterator;
 
  public:
   ServiceChannel(const std::string& service_name)
-      : _service_name(service_name) {}
+      : _service_name(service_name),
+        _metric(Metrics::call("rpc_client_" + metric_name(service_name))) {}
 
   void insert(const std::string& host) {
-    auto channel = std::make_shared<brpc::Channel>();
+    auto channel = std::make_shared<MeteredChannel>(_metric);
 
     brpc::ChannelOptions options;
     options.max_retry = -1;
@@ -73,6 +132,7 @@ class ServiceChannel {
 
  private:
   std::string _service_name;
+  CallMetric& _metric;
   std::list<ChannelPtr> _channels;
   ListIt _it = _channels.begin();  // 轮转迭代器
   std::unordered_map<std::string, ListIt> _host_it_map;
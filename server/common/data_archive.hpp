@@ -0,0 +1,671 @@
+#pragma once
+#include <zlib.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+
+#include "archive.pb.h"
+#include "data_mysql_message.hpp"
+#include "logger.hpp"
+
+namespace huzch {
+
+// 月份工具：归档按 UTC 自然月组织
+inline std::string month_of(const boost::posix_time::ptime& time) {
+  auto date = time.date();
+  char buf[8];
+  snprintf(buf, sizeof(buf), "%04d%02d", static_cast<int>(date.year()),
+           static_cast<int>(date.month()));
+  return buf;
+}
+
+inline boost::posix_time::ptime month_begin(
+    const boost::posix_time::ptime& time) {
+  auto date = time.date();
+  return boost::posix_time::ptime(
+      boost::gregorian::date(date.year(), date.month(), 1));
+}
+
+inline boost::posix_time::ptime next_month(
+    const boost::posix_time::ptime& time) {
+  return boost::posix_time::ptime(month_begin(time).date() +
+                                  boost::gregorian::months(1));
+}
+
+// 冷消息归档：每个(月份, 会话)一个zlib压缩的列式分段文件
+// 目录结构: <archive_dir>/<yyyymm>/<session_id>.seg
+// MANIFEST 记录水位线，早于水位线的消息只存在于归档中；
+// 归档目录为各消息服务实例共享的存储，水位线可能由其他实例推进
+class MessageArchive {
+ public:
+  using Ptr = std::shared_ptr<MessageArchive>;
+
+ public:
+  MessageArchive(const std::string& archive_dir)
+      : _archive_dir(archive_dir),
+        _watermark(boost::posix_time::from_time_t(0)) {
+    std::filesystem::create_directories(_archive_dir);
+    std::unique_lock<std::mutex> lock(_mutex);
+    load();
+  }
+
+  // 每次查询都检查 MANIFEST，其他实例归档后立即可见
+  boost::posix_time::ptime watermark() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    load();
+    return _watermark;
+  }
+
+  // 写入同一会话同一月份的消息，已封存月份的迟到消息与原分段合并
+  bool write(const std::string& month, const std::vector<Message>& messages) {
+    if (messages.empty()) {
+      return true;
+    }
+    std::string session_id = messages.front().session_id();
+    auto path = segment_path(month, session_id);
+
+    std::vector<Message> merged;
+    if (month < month_of(watermark()) && std::filesystem::exists(path)) {
+      if (!read(path, merged)) {
+        return false;
+      }
+    }
+    merged.insert(merged.end(), messages.begin(), messages.end());
+    std::stable_sort(merged.begin(), merged.end(),
+                     [](const Message& a, const Message& b) {
+                       return a.create_time() < b.create_time();
+                     });
+
+    // 分区删除失败后重新归档时，跳过已写入的消息
+    std::unordered_set<std::string> messages_id;
+    MessageSegment segment;
+    segment.set_session_id(session_id);
+    for (const auto& message : merged) {
+      if (!messages_id.insert(message.message_id()).second) {
+        continue;
+      }
+      segment.add_message_id(message.message_id());
+      segment.add_user_id(message.user_id());
+      segment.add_message_type(message.message_type());
+      segment.add_create_time(
+          boost::posix_time::to_time_t(message.create_time()));
+      segment.add_seq(message.seq());
+      segment.add_content(message.content());
+      segment.add_file_id(message.file_id());
+      segment.add_file_name(message.file_name());
+      segment.add_file_size(message.file_size());
+    }
+    std::string raw = segment.SerializeAsString();
+
+    uLongf compressed_size = compressBound(raw.size());
+    std::string compressed(compressed_size, '\0');
+    int ret = compress2(reinterpret_cast<Bytef*>(compressed.data()),
+                        &compressed_size,
+                        reinterpret_cast<const Bytef*>(raw.data()), raw.size(),
+                        Z_BEST_COMPRESSION);
+    if (ret != Z_OK) {
+      LOG_ERROR("会话 {} {} 归档分段压缩失败: {}", session_id, month, ret);
+      return false;
+    }
+    compressed.resize(compressed_size);
+
+    // 先写临时文件再重命名，避免读到半截分段
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    {
+      std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+      uint64_t raw_size = raw.size();
+      ofs.write(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+      ofs.write(compressed.data(), compressed.size());
+      if (!ofs) {
+        LOG_ERROR("会话 {} {} 归档分段写入失败", session_id, month);
+        return false;
+      }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+      LOG_ERROR("会话 {} {} 归档分段重命名失败: {}", session_id, month,
+                ec.message());
+      return false;
+    }
+    return true;
+  }
+
+  // 推进水位线，此后该时刻之前的查询只读归档
+  bool seal(const boost::posix_time::ptime& watermark) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto path = _archive_dir / "MANIFEST";
+    auto tmp_path = _archive_dir / "MANIFEST.tmp";
+    {
+      std::ofstream ofs(tmp_path, std::ios::trunc);
+      ofs << boost::posix_time::to_time_t(watermark);
+      if (!ofs) {
+        LOG_ERROR("归档水位线写入失败");
+        return false;
+      }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+      LOG_ERROR("归档水位线重命名失败: {}", ec.message());
+      return false;
+    }
+    _watermark = watermark;
+    _manifest_time = std::filesystem::last_write_time(path, ec);
+    return true;
+  }
+
+  std::vector<Message> range(const std::string& session_id,
+                             const boost::posix_time::ptime& start_time,
+                             const boost::posix_time::ptime& end_time,
+                             size_t count) {
+    std::vector<Message> messages;
+    auto watermark = this->watermark();
+    if (start_time >= watermark) {
+      return messages;
+    }
+    std::string first = month_of(start_time);
+    std::string last = month_of(std::min(
+        end_time, watermark - boost::posix_time::seconds(1)));
+
+    for (const auto& month : months(first, last)) {
+      auto path = segment_path(month, session_id);
+      if (!std::filesystem::exists(path)) {
+        continue;
+      }
+      std::vector<Message> segment;
+      if (!read(path, segment)) {
+        continue;
+      }
+      for (auto& message : segment) {
+        if (message.create_time() < start_time ||
+            message.create_time() > end_time ||
+            message.create_time() >= watermark) {
+          continue;
+        }
+        messages.push_back(std::move(message));
+        if (messages.size() >= count) {
+          return messages;
+        }
+      }
+    }
+    return messages;
+  }
+
+  // 键集分页：锚点 message_id 之前的 count 条归档消息，message_id 为空时
+  // 取水位线之前最新的 count 条；锚点不在归档中时返回false
+  bool before(const std::string& session_id, const std::string& message_id,
+              size_t count, std::vector<Message>& messages) {
+    auto watermark = this->watermark();
+    bool found = message_id.empty();
+    std::vector<Message> reversed;
+    auto archived = months(std::string(),
+                           month_of(watermark - boost::posix_time::seconds(1)));
+    for (auto month = archived.rbegin();
+         month != archived.rend() && reversed.size() < count; ++month) {
+      auto path = segment_path(*month, session_id);
+      std::vector<Message> segment;
+      if (!std::filesystem::exists(path) || !read(path, segment)) {
+        continue;
+      }
+      for (auto it = segment.rbegin();
+           it != segment.rend() && reversed.size() < count; ++it) {
+        if (it->create_time() >= watermark) {
+          continue;
+        }
+        if (!found) {
+          found = it->message_id() == message_id;
+          continue;
+        }
+        reversed.push_back(std::move(*it));
+      }
+    }
+    messages.insert(messages.begin(), std::make_move_iterator(reversed.rbegin()),
+                    std::make_move_iterator(reversed.rend()));
+    return found;
+  }
+
+  // 增量同步：序号大于 seq 的 count 条归档消息，按序号升序
+  std::vector<Message> since(const std::string& session_id,
+                             unsigned long long seq, size_t count) {
+    std::vector<Message> messages;
+    auto watermark = this->watermark();
+    for (const auto& month : months(
+             std::string(),
+             month_of(watermark - boost::posix_time::seconds(1)))) {
+      auto path = segment_path(month, session_id);
+      std::vector<Message> segment;
+      if (!std::filesystem::exists(path) || !read(path, segment)) {
+        continue;
+      }
+      for (auto& message : segment) {
+        if (message.seq() > seq && message.create_time() < watermark) {
+          messages.push_back(std::move(message));
+        }
+      }
+      // 序号随时间递增，凑满一个月份后即可停止
+      if (messages.size() >= count) {
+        break;
+      }
+    }
+    std::sort(messages.begin(), messages.end(),
+              [](const Message& a, const Message& b) {
+                return a.seq() < b.seq();
+              });
+    if (messages.size() > count) {
+      messages.resize(count);
+    }
+    return messages;
+  }
+
+ private:
+  // MANIFEST 修改时间变化时重新读取水位线，调用方持有 _mutex
+  void load() {
+    auto path = _archive_dir / "MANIFEST";
+    std::error_code ec;
+    auto manifest_time = std::filesystem::last_write_time(path, ec);
+    if (ec || manifest_time == _manifest_time) {
+      return;
+    }
+    std::ifstream ifs(path);
+    time_t watermark = 0;
+    if (ifs >> watermark) {
+      _watermark = boost::posix_time::from_time_t(watermark);
+      _manifest_time = manifest_time;
+    }
+  }
+
+  // [first, last] 范围内已归档的月份，升序
+  std::vector<std::string> months(const std::string& first,
+                                  const std::string& last) {
+    std::vector<std::string> months;
+    std::error_code ec;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(_archive_dir, ec)) {
+      std::string month = entry.path().filename().string();
+      if (entry.is_directory() && month >= first && month <= last) {
+        months.push_back(month);
+      }
+    }
+    std::sort(months.begin(), months.end());
+    return months;
+  }
+
+  std::filesystem::path segment_path(const std::string& month,
+                                     const std::string& session_id) {
+    return _archive_dir / month / (session_id + ".seg");
+  }
+
+  bool read(const std::filesystem::path& path, std::vector<Message>& messages) {
+    std::ifstream ifs(path, std::ios::binary);
+    uint64_t raw_size = 0;
+    if (!ifs.read(reinterpret_cast<char*>(&raw_size), sizeof(raw_size))) {
+      LOG_ERROR("归档分段 {} 读取失败", path.string());
+      return false;
+    }
+    std::string compressed((std::istreambuf_iterator<char>(ifs)),
+                           std::istreambuf_iterator<char>());
+
+    std::string raw(raw_size, '\0');
+    uLongf size = raw_size;
+    int ret = uncompress(reinterpret_cast<Bytef*>(raw.data()), &size,
+                         reinterpret_cast<const Bytef*>(compressed.data()),
+                         compressed.size());
+    MessageSegment segment;
+    if (ret != Z_OK || !segment.ParseFromString(raw)) {
+      LOG_ERROR("归档分段 {} 解析失败: {}", path.string(), ret);
+      return false;
+    }
+
+    messages.reserve(messages.size() + segment.message_id_size());
+    for (int i = 0; i < segment.message_id_size(); ++i) {
+      Message message(segment.message_id(i), segment.session_id(),
+                      segment.user_id(i), segment.message_type(i),
+                      boost::posix_time::from_time_t(segment.create_time(i)));
+      message.seq(segment.seq(i));
+      if (!segment.content(i).empty()) {
+        message.content(segment.content(i));
+      }
+      if (!segment.file_id(i).empty()) {
+        message.file_id(segment.file_id(i));
+        message.file_name(segment.file_name(i));
+        message.file_size(segment.file_size(i));
+      }
+      messages.push_back(std::move(message));
+    }
+    return true;
+  }
+
+ private:
+  std::filesystem::path _archive_dir;
+  std::mutex _mutex;
+  boost::posix_time::ptime _watermark;
+  std::filesystem::file_time_type _manifest_time;
+};
+
+// 历史消息统一查询：水位线之前读归档，之后读mysql
+class MessageHistory {
+ public:
+  using Ptr = std::shared_ptr<MessageHistory>;
+
+ public:
+  MessageHistory(const MessageTable::Ptr& mysql_message,
+                 const MessageArchive::Ptr& archive)
+      : _mysql_message(mysql_message), _archive(archive) {}
+
+  std::vector<Message> range(const std::string& session_id,
+                             const boost::posix_time::ptime& start_time,
+                             const boost::posix_time::ptime& end_time,
+                             size_t count) {
+    auto watermark = _archive->watermark();
+    if (start_time >= watermark) {
+      return _mysql_message->range(session_id, start_time, end_time, count);
+    }
+
+    auto messages = _archive->range(session_id, start_time, end_time, count);
+    if (end_time < watermark || messages.size() >= count) {
+      return messages;
+    }
+    auto hot = _mysql_message->range(session_id, watermark, end_time,
+                                     count - messages.size());
+    messages.insert(messages.end(), std::make_move_iterator(hot.begin()),
+                    std::make_move_iterator(hot.end()));
+    return messages;
+  }
+
+  // 最近消息：mysql 中不足 count 条且会话有归档消息时，从归档补齐更早的部分
+  std::vector<Message> recent(const std::string& session_id, size_t count) {
+    auto messages = _mysql_message->recent(session_id, count);
+    if (complete(session_id, messages, count)) {
+      return messages;
+    }
+    _archive->before(session_id, std::string(), count - messages.size(),
+                     messages);
+    return messages;
+  }
+
+  // 键集分页：锚点已归档时在归档中翻页，锚点在mysql中但之前的热数据
+  // 不足 count 条时从归档补齐
+  std::vector<Message> before(const std::string& session_id,
+                              const std::string& message_id, size_t count) {
+    std::vector<Message> messages;
+    if (_mysql_message->before(session_id, message_id, count, messages)) {
+      if (!complete(session_id, messages, count)) {
+        _archive->before(session_id, std::string(), count - messages.size(),
+                         messages);
+      }
+      return messages;
+    }
+
+    if (_mysql_message->archived_seq(session_id) <= 0 ||
+        !_archive->before(session_id, message_id, count, messages)) {
+      LOG_ERROR("会话 {} 中锚点消息 {} 不存在", session_id, message_id);
+    }
+    return messages;
+  }
+
+  // 增量同步：游标之后紧接的消息已归档时，合并归档与mysql中的消息，
+  // 避免跳过游标之后被归档的序号
+  std::vector<Message> since(const std::string& session_id,
+                             unsigned long long seq, size_t count) {
+    auto messages = _mysql_message->since(session_id, seq, count);
+    if (!messages.empty() && messages.front().seq() == seq + 1) {
+      return messages;
+    }
+    long long archived_seq = _mysql_message->archived_seq(session_id);
+    if (archived_seq <= 0 ||
+        static_cast<unsigned long long>(archived_seq) <= seq) {
+      return messages;
+    }
+
+    auto cold = _archive->since(session_id, seq, count);
+    // 分区归档后、删除前，消息同时存在于归档与mysql中
+    std::unordered_set<std::string> messages_id;
+    for (const auto& message : cold) {
+      messages_id.insert(message.message_id());
+    }
+    for (auto& message : messages) {
+      if (!messages_id.count(message.message_id())) {
+        cold.push_back(std::move(message));
+      }
+    }
+    std::stable_sort(cold.begin(), cold.end(),
+                     [](const Message& a, const Message& b) {
+                       return a.seq() < b.seq();
+                     });
+    if (cold.size() > count) {
+      cold.resize(count);
+    }
+    return cold;
+  }
+
+ private:
+  // mysql 中的结果已够 count 条、已到会话第一条消息或会话没有归档消息时，
+  // 无需再查归档
+  bool complete(const std::string& session_id,
+                const std::vector<Message>& messages, size_t count) {
+    if (messages.size() >= count ||
+        (!messages.empty() && messages.front().seq() <= 1)) {
+      return true;
+    }
+    return _mysql_message->archived_seq(session_id) <= 0;
+  }
+
+ private:
+  MessageTable::Ptr _mysql_message;
+  MessageArchive::Ptr _archive;
+};
+
+// 归档线程：预建后续月份分区，并将超过保留期的分区导出到归档后删除；
+// 每个实例都运行归档线程，由 mysql 命名锁保证同一时刻只有一个实例执行
+class MessageArchiver {
+ public:
+  using Ptr = std::shared_ptr<MessageArchiver>;
+
+ public:
+  MessageArchiver(const MessageTable::Ptr& mysql_message,
+                  const MessageArchive::Ptr& archive, int retention_months,
+                  int interval, size_t batch_size)
+      : _mysql_message(mysql_message),
+        _archive(archive),
+        _retention_months(retention_months),
+        _interval(interval),
+        _batch_size(batch_size),
+        _thread(&MessageArchiver::run, this) {}
+
+  ~MessageArchiver() {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+  }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+      lock.unlock();
+      auto conn = _mysql_message->lock_archive();
+      if (conn) {
+        run_once();
+        _mysql_message->unlock_archive(conn);
+      }
+      lock.lock();
+      _cond.wait_for(lock, std::chrono::seconds(_interval),
+                     [this]() { return _stop; });
+    }
+  }
+
+  void run_once() {
+    auto now = boost::posix_time::second_clock::universal_time();
+    for (size_t shard = 0; shard < _mysql_message->shards(); ++shard) {
+      prepare(shard, now);
+    }
+
+    // 各分片按相同的月份边界分区，以第一个分片的分区列表为准
+    auto partitions = _mysql_message->partitions(size_t(0));
+    if (partitions.empty()) {
+      LOG_WARN("消息表未分区，跳过归档");
+      return;
+    }
+
+    // 归档超过保留期的分区，分区按上界升序排列
+    auto cutoff = boost::posix_time::ptime(
+        month_begin(now).date() - boost::gregorian::months(_retention_months));
+    for (const auto& partition : partitions) {
+      if (partition.name == "pmax") {
+        break;
+      }
+      boost::posix_time::ptime end_time;
+      if (!partition_end(partition, end_time)) {
+        continue;
+      }
+      if (end_time > cutoff) {
+        break;
+      }
+      bool ret = true;
+      for (size_t shard = 0; ret && shard < _mysql_message->shards();
+           ++shard) {
+        ret = archive(shard, partition, end_time);
+      }
+      if (!ret || !_archive->seal(end_time)) {
+        break;
+      }
+      for (size_t shard = 0; shard < _mysql_message->shards(); ++shard) {
+        _mysql_message->drop_partition(shard, partition.name);
+      }
+      LOG_INFO("消息表分区 {} 归档完毕", partition.name);
+    }
+  }
+
+  // 预建分区，保证当前月之后还有两个月的分区可用
+  void prepare(size_t shard, const boost::posix_time::ptime& now) {
+    auto partitions = _mysql_message->partitions(shard);
+    if (partitions.empty()) {
+      return;
+    }
+
+    boost::posix_time::ptime last = boost::posix_time::from_time_t(0);
+    for (const auto& partition : partitions) {
+      boost::posix_time::ptime end_time;
+      if (partition.name != "pmax" && partition_end(partition, end_time)) {
+        last = end_time;
+      }
+    }
+    if (last == boost::posix_time::from_time_t(0)) {
+      // 新部署只有 pmax，从当前月起建分区，此前写入 pmax 的少量消息
+      // 随第一个分区一起拆出
+      last = month_begin(now);
+    } else {
+      // 分区上界可能受数据库时区影响偏移数小时，归一化到最近的月初
+      last = month_begin(last + boost::gregorian::days(1));
+    }
+    auto target = boost::posix_time::ptime(month_begin(now).date() +
+                                           boost::gregorian::months(3));
+    while (last < target) {
+      auto next = next_month(last);
+      if (!_mysql_message->add_partition(shard, "p" + month_of(last),
+                                         boost::posix_time::to_time_t(next))) {
+        break;
+      }
+      last = next;
+    }
+  }
+
+  bool archive(size_t shard, const MessagePartition& partition,
+               const boost::posix_time::ptime& end_time) {
+    std::string session_id;
+    auto create_time = boost::posix_time::from_time_t(0);
+    unsigned long id = 0;
+
+    // 扫描结果按会话、时间有序，同一(会话, 月份)的消息连续出现
+    std::vector<Message> segment;
+    std::string segment_month;
+    while (true) {
+      std::vector<Message> messages;
+      if (!_mysql_message->scan(shard, end_time, session_id, create_time, id,
+                                _batch_size, messages)) {
+        return false;
+      }
+      for (auto& message : messages) {
+        std::string month = month_of(message.create_time());
+        if (!segment.empty() &&
+            (message.session_id() != segment.back().session_id() ||
+             month != segment_month)) {
+          if (!write(shard, segment_month, segment)) {
+            return false;
+          }
+          segment.clear();
+        }
+        segment_month = month;
+        segment.push_back(message);
+      }
+      if (messages.size() < _batch_size) {
+        break;
+      }
+      session_id = messages.back().session_id();
+      create_time = messages.back().create_time();
+      id = messages.back().id();
+    }
+    return write(shard, segment_month, segment);
+  }
+
+  // 写入分段并记录会话已归档的最大序号，分区删除后序号计数器仍可恢复
+  bool write(size_t shard, const std::string& month,
+             const std::vector<Message>& segment) {
+    if (segment.empty()) {
+      return true;
+    }
+    if (!_archive->write(month, segment)) {
+      return false;
+    }
+    unsigned long long seq = 0;
+    for (const auto& message : segment) {
+      seq = std::max(seq, message.seq());
+    }
+    return _mysql_message->archive_seq(shard, segment.front().session_id(),
+                                       seq);
+  }
+
+  // 解析分区上界，MAXVALUE 等非数值上界解析失败时跳过该分区
+  static bool partition_end(const MessagePartition& partition,
+                            boost::posix_time::ptime& end_time) {
+    try {
+      size_t pos = 0;
+      long long seconds = std::stoll(partition.description, &pos);
+      if (pos != partition.description.size()) {
+        throw std::invalid_argument(partition.description);
+      }
+      end_time = boost::posix_time::from_time_t(seconds);
+    } catch (const std::exception&) {
+      LOG_WARN("消息表分区 {} 上界无法解析: {}", partition.name,
+               partition.description);
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  MessageTable::Ptr _mysql_message;
+  MessageArchive::Ptr _archive;
+  int _retention_months;
+  int _interval;
+  size_t _batch_size;
+
+  bool _stop = false;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::thread _thread;
+};
+
+}  // namespace huzch
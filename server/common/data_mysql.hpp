@@ -1,6 +1,9 @@
 #pragma once
 #include <odb/database.hxx>
 #include <odb/mysql/database.hxx>
+#include <sstream>
+
+#include "data_mysql_pool.hpp"
 
 namespace huzch {
 
@@ -9,12 +12,33 @@ class MysqlClientFactory {
   static std::shared_ptr<odb::core::database> create(
       const std::string& user, const std::string& passwd, const std::string& db,
       const std::string& host, size_t port, const std::string& charset,
-      size_t max_connections) {
-    auto cpf =
-        std::make_unique<odb::mysql::connection_pool_factory>(max_connections);
+      size_t max_connections, size_t min_connections) {
+    auto cpf = std::make_unique<ShardedConnectionFactory>(max_connections,
+                                                          min_connections);
     return std::make_shared<odb::mysql::database>(
         user, passwd, db, host, port, "", charset, 0, std::move(cpf));
   }
+
+  // 解析以 delim 分隔的 host:port 列表
+  static std::vector<std::pair<std::string, size_t>> parse(
+      const std::string& hosts, char delim = ',') {
+    std::vector<std::pair<std::string, size_t>> result;
+    std::stringstream ss(hosts);
+    std::string item;
+    while (std::getline(ss, item, delim)) {
+      if (item.empty()) {
+        continue;
+      }
+      size_t pos = item.rfind(':');
+      if (pos == std::string::npos) {
+        result.emplace_back(item, 0);
+      } else {
+        result.emplace_back(item.substr(0, pos),
+                            std::stoul(item.substr(pos + 1)));
+      }
+    }
+    return result;
+  }
 };
 
 }  // namespace huzch
\ No newline at end of file
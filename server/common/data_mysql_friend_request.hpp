@@ -1,5 +1,5 @@
 #pragma once
-#include "data_mysql.hpp"
+#include "data_mysql_replica.hpp"
 #include "friend_request-odb.hxx"
 #include "friend_request.hxx"
 #include "logger.hpp"
@@ -11,14 +11,16 @@ class FriendRequestTable {
   using Ptr = std::shared_ptr<FriendRequestTable>;
 
  public:
-  FriendRequestTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  FriendRequestTable(const ReplicatedDatabase::Ptr& db) : _mysql_client(db) {}
 
   bool insert(FriendRequest& friend_request) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->persist(friend_request);
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
+      db->persist(friend_request);
       t.commit();
+      _mysql_client->mark_write(friend_request.user_id());
+      _mysql_client->mark_write(friend_request.peer_id());
     } catch (const std::exception& e) {
       LOG_ERROR("好友申请 {}-{} 新增失败: {}", friend_request.user_id(),
                 friend_request.peer_id(), e.what());
@@ -29,11 +31,14 @@ class FriendRequestTable {
 
   bool remove(const std::string& user_id, const std::string& peer_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<FriendRequest>(
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<FriendRequest>(
           odb::query<FriendRequest>::user_id == user_id &&
           odb::query<FriendRequest>::peer_id == peer_id);
       t.commit();
+      _mysql_client->mark_write(user_id);
+      _mysql_client->mark_write(peer_id);
     } catch (const std::exception& e) {
       LOG_ERROR("好友申请 {}-{} 移除失败: {}", user_id, peer_id, e.what());
       return false;
@@ -43,8 +48,9 @@ class FriendRequestTable {
 
   bool exists(const std::string& user_id, const std::string& peer_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<FriendRequest>(
+      auto& db = _mysql_client->replica(user_id);
+      odb::transaction t(db->begin());
+      auto result = db->query<FriendRequest>(
           odb::query<FriendRequest>::user_id == user_id &&
           odb::query<FriendRequest>::peer_id == peer_id);
       t.commit();
@@ -58,8 +64,9 @@ class FriendRequestTable {
   std::vector<std::string> requesters_id(const std::string& user_id) {
     std::vector<std::string> requesters_id;
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<FriendRequest>(
+      auto& db = _mysql_client->replica(user_id);
+      odb::transaction t(db->begin());
+      auto result = db->query<FriendRequest>(
           odb::query<FriendRequest>::peer_id == user_id);
       requesters_id.reserve(result.size());
       for (auto& requester : result) {
@@ -74,7 +81,7 @@ class FriendRequestTable {
   }
 
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ReplicatedDatabase::Ptr _mysql_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
@@ -1,5 +1,8 @@
 #pragma once
-#include "data_mysql.hpp"
+#include <mysql/mysqld_error.h>
+#include <odb/mysql/exceptions.hxx>
+
+#include "data_mysql_shard.hpp"
 #include "logger.hpp"
 #include "message-odb.hxx"
 #include "message.hxx"
@@ -9,16 +12,30 @@ namespace huzch {
 class MessageTable {
  public:
   using Ptr = std::shared_ptr<MessageTable>;
+  using query = odb::query<Message>;
+  using prepared_query = odb::prepared_query<Message>;
 
  public:
-  MessageTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  MessageTable(const ShardedDatabase::Ptr& db) : _mysql_client(db) {}
+
+  size_t shards() const { return _mysql_client->size(); }
 
+  // 幂等写入：消息队列重投的同一消息触发唯一索引冲突，视为已写入
   bool insert(Message& message) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->persist(message);
+      auto& shard = _mysql_client->shard(message.session_id());
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->persist(message);
       t.commit();
+      shard->mark_write(message.session_id());
+    } catch (const odb::mysql::database_exception& e) {
+      if (e.error() == ER_DUP_ENTRY) {
+        LOG_DEBUG("消息 {} 已存在，忽略重复写入", message.message_id());
+        return true;
+      }
+      LOG_ERROR("消息 {} 新增失败: {}", message.message_id(), e.what());
+      return false;
     } catch (const std::exception& e) {
       LOG_ERROR("消息 {} 新增失败: {}", message.message_id(), e.what());
       return false;
@@ -28,10 +45,12 @@ class MessageTable {
 
   bool remove(const std::string& session_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<Message>(odb::query<Message>::session_id ==
-                                          session_id);
+      auto& shard = _mysql_client->shard(session_id);
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<Message>(query::session_id == session_id);
       t.commit();
+      shard->mark_write(session_id);
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 移除所有消息失败: {}", session_id, e.what());
       return false;
@@ -42,13 +61,25 @@ class MessageTable {
   std::vector<Message> recent(const std::string& session_id, size_t count) {
     std::vector<Message> messages;
     try {
-      odb::transaction t(_mysql_client->begin());
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      odb::connection& conn(t.connection());
 
-      std::string condition = "session_id='" + session_id +
-                              "' order by create_time desc limit " +
-                              std::to_string(count);
+      RecentParams* params = nullptr;
+      prepared_query pq(conn.lookup_query<Message>("message_recent", params));
+      if (!pq) {
+        std::unique_ptr<RecentParams> up(new RecentParams);
+        params = up.get();
+        query q(query::session_id == query::_ref(params->session_id));
+        q += "ORDER BY" + query::create_time + "DESC," + query::id + "DESC";
+        q += "LIMIT" + query::_ref(params->count);
+        pq = conn.prepare_query<Message>("message_recent", q);
+        conn.cache_query(pq, std::move(up));
+      }
+      params->session_id = session_id;
+      params->count = count;
 
-      auto result = _mysql_client->query<Message>(condition);
+      auto result = pq.execute();
       messages.reserve(result.size());
       for (const auto& message : result) {
         messages.push_back(message);
@@ -63,16 +94,97 @@ class MessageTable {
     return messages;
   }
 
+  // 键集分页：获取会话中 message_id 之前的 count 条消息，
+  // 锚点消息不在mysql中(已归档或不存在)时返回false
+  bool before(const std::string& session_id, const std::string& message_id,
+              size_t count, std::vector<Message>& messages) {
+    try {
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      odb::connection& conn(t.connection());
+
+      // 先定位锚点消息(唯一索引)，再以 (create_time, id) 为键向前翻页
+      AnchorParams* anchor_params = nullptr;
+      prepared_query anchor_pq(
+          conn.lookup_query<Message>("message_anchor", anchor_params));
+      if (!anchor_pq) {
+        std::unique_ptr<AnchorParams> up(new AnchorParams);
+        anchor_params = up.get();
+        query q(query::message_id == query::_ref(anchor_params->message_id));
+        anchor_pq = conn.prepare_query<Message>("message_anchor", q);
+        conn.cache_query(anchor_pq, std::move(up));
+      }
+      anchor_params->message_id = message_id;
+
+      std::unique_ptr<Message> anchor(anchor_pq.execute_one());
+      if (!anchor || anchor->session_id() != session_id) {
+        t.commit();
+        return false;
+      }
+
+      BeforeParams* params = nullptr;
+      prepared_query pq(conn.lookup_query<Message>("message_before", params));
+      if (!pq) {
+        std::unique_ptr<BeforeParams> up(new BeforeParams);
+        params = up.get();
+        query q(query::session_id == query::_ref(params->session_id) &&
+                (query::create_time < query::_ref(params->create_time) ||
+                 (query::create_time == query::_ref(params->create_time) &&
+                  query::id < query::_ref(params->id))));
+        q += "ORDER BY" + query::create_time + "DESC," + query::id + "DESC";
+        q += "LIMIT" + query::_ref(params->count);
+        pq = conn.prepare_query<Message>("message_before", q);
+        conn.cache_query(pq, std::move(up));
+      }
+      params->session_id = session_id;
+      params->create_time = anchor->create_time();
+      params->id = anchor->id();
+      params->count = count;
+
+      auto result = pq.execute();
+      messages.reserve(result.size());
+      for (const auto& message : result) {
+        messages.push_back(message);
+      }
+      std::reverse(messages.begin(), messages.end());
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 获取消息 {} 之前 {} 条消息失败: {}", session_id,
+                message_id, count, e.what());
+      return false;
+    }
+    return true;
+  }
+
   std::vector<Message> range(const std::string& session_id,
                              const boost::posix_time::ptime& start_time,
-                             const boost::posix_time::ptime& end_time) {
+                             const boost::posix_time::ptime& end_time,
+                             size_t count) {
     std::vector<Message> messages;
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<Message>(
-          odb::query<Message>::session_id == session_id &&
-          odb::query<Message>::create_time >= start_time &&
-          odb::query<Message>::create_time <= end_time);
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      odb::connection& conn(t.connection());
+
+      RangeParams* params = nullptr;
+      prepared_query pq(conn.lookup_query<Message>("message_range", params));
+      if (!pq) {
+        std::unique_ptr<RangeParams> up(new RangeParams);
+        params = up.get();
+        query q(query::session_id == query::_ref(params->session_id) &&
+                query::create_time >= query::_ref(params->start_time) &&
+                query::create_time <= query::_ref(params->end_time));
+        q += "ORDER BY" + query::create_time + "ASC," + query::id + "ASC";
+        q += "LIMIT" + query::_ref(params->count);
+        pq = conn.prepare_query<Message>("message_range", q);
+        conn.cache_query(pq, std::move(up));
+      }
+      params->session_id = session_id;
+      params->start_time = start_time;
+      params->end_time = end_time;
+      params->count = count;
+
+      auto result = pq.execute();
       messages.reserve(result.size());
       for (const auto& message : result) {
         messages.push_back(message);
@@ -87,8 +199,269 @@ class MessageTable {
     return messages;
   }
 
+  // 增量同步：获取会话中序号大于 seq 的 count 条消息
+  std::vector<Message> since(const std::string& session_id,
+                             unsigned long long seq, size_t count) {
+    std::vector<Message> messages;
+    try {
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      odb::connection& conn(t.connection());
+
+      SinceParams* params = nullptr;
+      prepared_query pq(conn.lookup_query<Message>("message_since", params));
+      if (!pq) {
+        std::unique_ptr<SinceParams> up(new SinceParams);
+        params = up.get();
+        query q(query::session_id == query::_ref(params->session_id) &&
+                query::seq > query::_ref(params->seq));
+        q += "ORDER BY" + query::seq + "ASC";
+        q += "LIMIT" + query::_ref(params->count);
+        pq = conn.prepare_query<Message>("message_since", q);
+        conn.cache_query(pq, std::move(up));
+      }
+      params->session_id = session_id;
+      params->seq = seq;
+      params->count = count;
+
+      auto result = pq.execute();
+      messages.reserve(result.size());
+      for (const auto& message : result) {
+        messages.push_back(message);
+      }
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 获取序号 {} 之后的消息失败: {}", session_id, seq,
+                e.what());
+      return messages;
+    }
+    return messages;
+  }
+
+  // 会话已持久化的最大序号，含已归档部分；读主库，用于恢复序号计数器
+  bool max_seq(const std::string& session_id, unsigned long long& seq) {
+    try {
+      auto& db = _mysql_client->shard(session_id)->primary();
+      odb::transaction t(db->begin());
+      seq = 0;
+      std::unique_ptr<MessageSeq> archived(db->find<MessageSeq>(session_id));
+      if (archived) {
+        seq = archived->seq();
+      }
+      auto result = db->query<Message>(
+          query(query::session_id == session_id) + "ORDER BY" + query::seq +
+          "DESC LIMIT 1");
+      for (const auto& message : result) {
+        seq = std::max(seq, message.seq());
+      }
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 获取最大消息序号失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // 会话已归档消息的最大序号，没有归档消息时为0，失败返回-1
+  long long archived_seq(const std::string& session_id) {
+    try {
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      std::unique_ptr<MessageSeq> archived(db->find<MessageSeq>(session_id));
+      t.commit();
+      return archived ? archived->seq() : 0;
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 获取已归档消息序号失败: {}", session_id, e.what());
+      return -1;
+    }
+  }
+
+  // 记录会话已归档消息的最大序号，只增不减
+  bool archive_seq(size_t shard, const std::string& session_id,
+                   unsigned long long seq) {
+    try {
+      auto& db = _mysql_client->shard(shard)->primary();
+      odb::transaction t(db->begin());
+      std::unique_ptr<MessageSeq> archived(db->find<MessageSeq>(session_id));
+      if (!archived) {
+        MessageSeq message_seq(session_id, seq);
+        db->persist(message_seq);
+      } else if (archived->seq() < seq) {
+        archived->seq(seq);
+        db->update(*archived);
+      }
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 记录归档消息序号失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // 归档扫描：按 (session_id, create_time, id) 顺序获取 end_time 之前、
+  // 位于上一批末尾消息之后的 count 条消息
+  bool scan(size_t shard, const boost::posix_time::ptime& end_time,
+            const std::string& session_id,
+            const boost::posix_time::ptime& create_time, unsigned long id,
+            size_t count, std::vector<Message>& messages) {
+    try {
+      odb::transaction t(_mysql_client->shard(shard)->primary()->begin());
+      odb::connection& conn(t.connection());
+
+      ScanParams* params = nullptr;
+      prepared_query pq(conn.lookup_query<Message>("message_scan", params));
+      if (!pq) {
+        std::unique_ptr<ScanParams> up(new ScanParams);
+        params = up.get();
+        query q(query::create_time < query::_ref(params->end_time) &&
+                (query::session_id > query::_ref(params->session_id) ||
+                 (query::session_id == query::_ref(params->session_id) &&
+                  (query::create_time > query::_ref(params->create_time) ||
+                   (query::create_time == query::_ref(params->create_time) &&
+                    query::id > query::_ref(params->id))))));
+        q += "ORDER BY" + query::session_id + "ASC," + query::create_time +
+             "ASC," + query::id + "ASC";
+        q += "LIMIT" + query::_ref(params->count);
+        pq = conn.prepare_query<Message>("message_scan", q);
+        conn.cache_query(pq, std::move(up));
+      }
+      params->end_time = end_time;
+      params->session_id = session_id;
+      params->create_time = create_time;
+      params->id = id;
+      params->count = count;
+
+      auto result = pq.execute();
+      messages.reserve(result.size());
+      for (const auto& message : result) {
+        messages.push_back(message);
+      }
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("分片 {} 扫描 {} 之前的消息失败: {}", shard,
+                boost::posix_time::to_simple_string(end_time), e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // 在独占的全局库连接上获取归档锁，返回持有锁的连接；
+  // 其他实例正在归档或出错时返回空
+  odb::connection_ptr lock_archive() {
+    try {
+      auto& db = _mysql_client->global()->primary();
+      odb::connection_ptr conn(db->connection());
+      odb::transaction t(conn->begin());
+      bool acquired = false;
+      auto result = db->query<ArchiveLock>();
+      for (const auto& row : result) {
+        acquired = !row.acquired.null() && *row.acquired == 1;
+      }
+      t.commit();
+      return acquired ? conn : odb::connection_ptr();
+    } catch (const std::exception& e) {
+      LOG_ERROR("获取归档锁失败: {}", e.what());
+      return odb::connection_ptr();
+    }
+  }
+
+  void unlock_archive(const odb::connection_ptr& conn) {
+    try {
+      conn->execute("DO RELEASE_LOCK('message_archiver')");
+    } catch (const std::exception& e) {
+      LOG_ERROR("释放归档锁失败: {}", e.what());
+    }
+  }
+
+  std::vector<MessagePartition> partitions(size_t shard) {
+    std::vector<MessagePartition> partitions;
+    try {
+      auto& db = _mysql_client->shard(shard)->primary();
+      odb::transaction t(db->begin());
+      auto result = db->query<MessagePartition>();
+      for (const auto& partition : result) {
+        partitions.push_back(partition);
+      }
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("分片 {} 获取消息表分区失败: {}", shard, e.what());
+      return partitions;
+    }
+    return partitions;
+  }
+
+  // 从 pmax 中拆分出上界为 less_than 的新分区
+  bool add_partition(size_t shard, const std::string& name, time_t less_than) {
+    try {
+      auto& db = _mysql_client->shard(shard)->primary();
+      odb::transaction t(db->begin());
+      db->execute(
+          "ALTER TABLE `message` REORGANIZE PARTITION `pmax` INTO ("
+          "PARTITION `" + name + "` VALUES LESS THAN (" +
+          std::to_string(less_than) +
+          "), PARTITION `pmax` VALUES LESS THAN MAXVALUE)");
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("分片 {} 消息表分区 {} 新增失败: {}", shard, name, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  bool drop_partition(size_t shard, const std::string& name) {
+    try {
+      auto& db = _mysql_client->shard(shard)->primary();
+      odb::transaction t(db->begin());
+      db->execute("ALTER TABLE `message` DROP PARTITION `" + name + "`");
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("分片 {} 消息表分区 {} 删除失败: {}", shard, name, e.what());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  // 预编译查询的绑定参数，随查询一起缓存在连接上
+  struct RecentParams {
+    std::string session_id;
+    unsigned long long count;
+  };
+
+  struct AnchorParams {
+    std::string message_id;
+  };
+
+  struct BeforeParams {
+    std::string session_id;
+    boost::posix_time::ptime create_time;
+    unsigned long id;
+    unsigned long long count;
+  };
+
+  struct RangeParams {
+    std::string session_id;
+    boost::posix_time::ptime start_time;
+    boost::posix_time::ptime end_time;
+    unsigned long long count;
+  };
+
+  struct ScanParams {
+    boost::posix_time::ptime end_time;
+    std::string session_id;
+    boost::posix_time::ptime create_time;
+    unsigned long id;
+    unsigned long long count;
+  };
+
+  struct SinceParams {
+    std::string session_id;
+    unsigned long long seq;
+    unsigned long long count;
+  };
+
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ShardedDatabase::Ptr _mysql_client;
 };
 
-}  // namespace huzch
\ No newline at end of file
+}  // namespace huzch
@@ -0,0 +1,269 @@
+#pragma once
+#include <bvar/bvar.h>
+#include <mysql/mysql.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <odb/mysql/connection-factory.hxx>
+#include <odb/mysql/database.hxx>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace huzch {
+
+// 分条(striped)连接池，替代 odb 自带的单锁连接池
+// 空闲连接按条带存放，每个线程(bthread worker 即 pthread)首次使用时按轮询
+// 绑定一个条带，平时只访问自己条带的锁，本条带为空时用 try_lock 从其他条带
+// 窃取，仍无空闲连接且未达上限时新建，达到上限才在本条带上等待归还
+// 取出闲置超过 ping_interval 的连接时先 ping，失效则丢弃重建
+// 等待时间、占用时间(借出到归还，近似一次数据库操作的耗时)、借出数、
+// 新建数、失效数以 mysql_pool_<host>_<port>_* 暴露为 bvar
+class ShardedConnectionFactory : public odb::mysql::connection_factory {
+ public:
+  ShardedConnectionFactory(
+      size_t max_connections, size_t min_connections = 0, size_t stripes = 0,
+      const std::chrono::seconds& ping_interval = std::chrono::seconds(30))
+      : _max_connections(max_connections),
+        _min_connections(std::min(min_connections, max_connections)),
+        _ping_interval(ping_interval),
+        _stripes(stripes ? stripes
+                         : std::max(1u, std::thread::hardware_concurrency())) {}
+
+  // 数据库对象构造时回调，此时暴露指标并预热连接，避免首批请求承担建连耗时
+  void database(database_type& db) override {
+    odb::mysql::connection_factory::database(db);
+    std::string prefix =
+        "mysql_pool_" + db.host() + "_" + std::to_string(db.port());
+    _wait_latency.expose(prefix + "_wait");
+    _hold_latency.expose(prefix + "_hold");
+    _in_use.expose(prefix + "_in_use");
+    _created.expose(prefix + "_created");
+    _broken.expose(prefix + "_broken");
+
+    for (size_t i = 0; i < _min_connections; ++i) {
+      try {
+        auto conn = create();
+        ++_total;
+        _created << 1;
+        auto& stripe = _stripes[i % _stripes.size()];
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        stripe.idle.push_back({conn, clock::now()});
+      } catch (const std::exception& e) {
+        LOG_ERROR("mysql连接池预热失败: {}", e.what());
+        break;
+      }
+    }
+  }
+
+  odb::mysql::connection_ptr connect() override {
+    butil::Timer timer;
+    timer.start();
+    size_t home = stripe_index();
+
+    while (true) {
+      Idle idle;
+      if (pop(home, idle) || steal(home, idle)) {
+        if (!validate(idle)) {
+          --_total;
+          continue;
+        }
+        return checkout(idle.conn, home, timer);
+      }
+
+      // 先占名额再建连，避免多个线程同时越过上限
+      size_t total = _total.load(std::memory_order_relaxed);
+      while (total < _max_connections) {
+        if (_total.compare_exchange_weak(total, total + 1)) {
+          PooledConnectionPtr conn;
+          try {
+            conn = create();
+          } catch (...) {
+            --_total;
+            throw;
+          }
+          _created << 1;
+          return checkout(conn, home, timer);
+        }
+      }
+
+      // 已达上限，在本条带上短暂等待归还后重试；
+      // 连接可能归还到其他条带或失效丢弃，因此不无限等待
+      wait(home);
+    }
+  }
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  class PooledConnection : public odb::mysql::connection {
+   public:
+    PooledConnection(ShardedConnectionFactory& factory)
+        : odb::mysql::connection(factory), _factory(factory) {
+      _callback.arg = this;
+      _callback.zero_counter = &PooledConnection::zero_counter;
+    }
+
+    // 借出时挂上回调，引用计数归零时归还连接池而不是释放
+    void attach() { callback_ = &_callback; }
+    void detach() { callback_ = nullptr; }
+
+    void reset() { recycle(); }
+
+    // 归还时放回的条带，即最近一次借出它的线程所绑定的条带
+    size_t stripe = 0;
+    // 最近一次借出的时间
+    int64_t checkout_us = 0;
+    // 借出期间的 span，处于请求上下文中时记录本次数据库操作
+    std::unique_ptr<Span> span;
+
+   private:
+    static bool zero_counter(void* arg) {
+      auto conn = static_cast<PooledConnection*>(arg);
+      return conn->_factory.release(conn);
+    }
+
+   private:
+    ShardedConnectionFactory& _factory;
+    odb::details::shared_base::refcount_callback _callback;
+  };
+  using PooledConnectionPtr = odb::details::shared_ptr<PooledConnection>;
+
+  struct Idle {
+    PooledConnectionPtr conn;
+    clock::time_point since;
+  };
+
+  struct Stripe {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<Idle> idle;
+    size_t waiters = 0;
+  };
+
+  // 线程首次访问任一连接池时取得序号，按序号取模绑定条带
+  size_t stripe_index() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t seq = next.fetch_add(1, std::memory_order_relaxed);
+    return seq % _stripes.size();
+  }
+
+  PooledConnectionPtr create() {
+    return PooledConnectionPtr(new (odb::details::shared)
+                                   PooledConnection(*this));
+  }
+
+  bool pop(size_t index, Idle& idle) {
+    auto& stripe = _stripes[index];
+    std::unique_lock<std::mutex> lock(stripe.mutex);
+    return take(stripe, idle);
+  }
+
+  bool steal(size_t home, Idle& idle) {
+    for (size_t i = 1; i < _stripes.size(); ++i) {
+      auto& stripe = _stripes[(home + i) % _stripes.size()];
+      std::unique_lock<std::mutex> lock(stripe.mutex, std::try_to_lock);
+      if (lock.owns_lock() && take(stripe, idle)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 后进先出，优先复用最近使用过的连接
+  bool take(Stripe& stripe, Idle& idle) {
+    if (stripe.idle.empty()) {
+      return false;
+    }
+    idle = std::move(stripe.idle.back());
+    stripe.idle.pop_back();
+    return true;
+  }
+
+  void wait(size_t home) {
+    auto& stripe = _stripes[home];
+    std::unique_lock<std::mutex> lock(stripe.mutex);
+    if (!stripe.idle.empty()) {
+      return;
+    }
+    ++stripe.waiters;
+    stripe.cond.wait_for(lock, std::chrono::milliseconds(10));
+    --stripe.waiters;
+  }
+
+  // 闲置过久的连接可能已被服务端断开，借出前 ping 一次
+  bool validate(const Idle& idle) {
+    if (clock::now() - idle.since < _ping_interval) {
+      return true;
+    }
+    if (mysql_ping(idle.conn->handle()) == 0) {
+      return true;
+    }
+    _broken << 1;
+    LOG_ERROR("mysql空闲连接已失效，丢弃重建");
+    return false;
+  }
+
+  odb::mysql::connection_ptr checkout(PooledConnectionPtr& conn, size_t home,
+                                      butil::Timer& timer) {
+    timer.stop();
+    _wait_latency << timer.u_elapsed();
+    _in_use << 1;
+    conn->stripe = home;
+    conn->checkout_us = butil::cpuwide_time_us();
+    Span* parent = Span::current();
+    if (parent && parent->enabled()) {
+      conn->span = std::make_unique<Span>("mysql", parent);
+    }
+    conn->attach();
+    return conn;
+  }
+
+  // 引用计数归零时回调，返回 true 表示由调用方释放连接
+  bool release(PooledConnection* conn) {
+    conn->detach();
+    _in_use << -1;
+    _hold_latency << butil::cpuwide_time_us() - conn->checkout_us;
+    if (conn->span) {
+      if (conn->failed()) {
+        conn->span->fail();
+      }
+      conn->span.reset();
+    }
+    if (conn->failed()) {
+      --_total;
+      return true;
+    }
+
+    conn->reset();
+    auto& stripe = _stripes[conn->stripe];
+    std::unique_lock<std::mutex> lock(stripe.mutex);
+    stripe.idle.push_back(
+        {PooledConnectionPtr(odb::details::inc_ref(conn)), clock::now()});
+    if (stripe.waiters) {
+      stripe.cond.notify_one();
+    }
+    return false;
+  }
+
+ private:
+  size_t _max_connections;
+  size_t _min_connections;
+  std::chrono::seconds _ping_interval;
+  std::vector<Stripe> _stripes;
+  std::atomic<size_t> _total{0};
+
+  // 连接池指标，可通过 brpc 内置服务的 /vars 查看
+  bvar::LatencyRecorder _wait_latency;
+  bvar::LatencyRecorder _hold_latency;
+  bvar::Adder<int64_t> _in_use;
+  bvar::Adder<int64_t> _created;
+  bvar::Adder<int64_t> _broken;
+};
+
+}  // namespace huzch
\ No newline at end of file
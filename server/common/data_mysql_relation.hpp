@@ -1,5 +1,5 @@
 #pragma once
-#include "data_mysql.hpp"
+#include "data_mysql_replica.hpp"
 #include "logger.hpp"
 #include "relation-odb.hxx"
 #include "relation.hxx"
@@ -11,17 +11,19 @@ class RelationTable {
   using Ptr = std::shared_ptr<RelationTable>;
 
  public:
-  RelationTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  RelationTable(const ReplicatedDatabase::Ptr& db) : _mysql_client(db) {}
 
   bool insert(const std::string& user_id, const std::string& peer_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
       Relation r1(user_id, peer_id);
       Relation r2(peer_id, user_id);
-      _mysql_client->persist(r1);
-      _mysql_client->persist(r2);
+      db->persist(r1);
+      db->persist(r2);
       t.commit();
+      _mysql_client->mark_write(user_id);
+      _mysql_client->mark_write(peer_id);
     } catch (const std::exception& e) {
       LOG_ERROR("好友关系 {}-{} 新增失败: {}", user_id, peer_id, e.what());
       return false;
@@ -31,14 +33,17 @@ class RelationTable {
 
   bool remove(const std::string& user_id, const std::string& peer_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<Relation>(
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<Relation>(
           odb::query<Relation>::user_id == user_id &&
           odb::query<Relation>::peer_id == peer_id);
-      _mysql_client->erase_query<Relation>(
+      db->erase_query<Relation>(
           odb::query<Relation>::user_id == peer_id &&
           odb::query<Relation>::peer_id == user_id);
       t.commit();
+      _mysql_client->mark_write(user_id);
+      _mysql_client->mark_write(peer_id);
     } catch (const std::exception& e) {
       LOG_ERROR("好友关系 {}-{} 移除失败: {}", user_id, peer_id, e.what());
       return false;
@@ -48,8 +53,9 @@ class RelationTable {
 
   bool exists(const std::string& user_id, const std::string& peer_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<Relation>(
+      auto& db = _mysql_client->replica(user_id);
+      odb::transaction t(db->begin());
+      auto result = db->query<Relation>(
           odb::query<Relation>::user_id == user_id &&
           odb::query<Relation>::peer_id == peer_id);
       t.commit();
@@ -63,8 +69,9 @@ class RelationTable {
   std::vector<std::string> friends_id(const std::string& user_id) {
     std::vector<std::string> friends_id;
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<Relation>(
+      auto& db = _mysql_client->replica(user_id);
+      odb::transaction t(db->begin());
+      auto result = db->query<Relation>(
           odb::query<Relation>::user_id == user_id);
       friends_id.reserve(result.size());
       for (const auto& relation : result) {
@@ -79,7 +86,7 @@ class RelationTable {
   }
 
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ReplicatedDatabase::Ptr _mysql_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
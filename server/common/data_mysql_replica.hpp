@@ -0,0 +1,245 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "data_mysql.hpp"
+#include "heartbeat-odb.hxx"
+#include "heartbeat.hxx"
+#include "logger.hpp"
+#include "trace.hpp"
+
+namespace huzch {
+
+// 主从读写分离
+// 写操作走主库；读操作轮询复制延迟未超限的从库，全部不可用时回退主库。
+// 用户发起写入后的 ryw_window 内，该用户请求中的读取仍走主库，保证读己之写；
+// 被写入的实体(用户或会话)同样记录窗口，覆盖其他用户读取刚被修改的实体。
+// 写入记录按键分片，读路径只对一个分片加共享锁
+class ReplicatedDatabase {
+ public:
+  using Ptr = std::shared_ptr<ReplicatedDatabase>;
+  using DatabasePtr = std::shared_ptr<odb::core::database>;
+
+ public:
+  ReplicatedDatabase(const DatabasePtr& primary,
+                     const std::vector<DatabasePtr>& replicas,
+                     const std::chrono::milliseconds& max_lag,
+                     const std::chrono::milliseconds& ryw_window)
+      : _primary(primary), _max_lag(max_lag), _ryw_window(ryw_window) {
+    for (const auto& db : replicas) {
+      auto replica = std::make_unique<Replica>();
+      replica->db = db;
+      _replicas.push_back(std::move(replica));
+    }
+    if (!_replicas.empty()) {
+      _thread = std::thread(&ReplicatedDatabase::run, this);
+    }
+  }
+
+  ~ReplicatedDatabase() {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+
+  const DatabasePtr& primary() const { return _primary; }
+
+  const DatabasePtr& replica(const std::string& key) {
+    if (_replicas.empty() || recently_written(key) ||
+        recently_written(user_key(RequestContext::user_id()))) {
+      return _primary;
+    }
+    size_t n = _replicas.size();
+    size_t start = _next.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+      auto& replica = _replicas[(start + i) % n];
+      if (replica->healthy.load(std::memory_order_relaxed)) {
+        return replica->db;
+      }
+    }
+    return _primary;
+  }
+
+  // 写事务提交后调用，开启该实体与当前请求发起用户的读己之写窗口
+  void mark_write(const std::string& key) {
+    if (_replicas.empty()) {
+      return;
+    }
+    auto until = std::chrono::steady_clock::now() + _ryw_window;
+    record_write(key, until);
+    const auto& user_id = RequestContext::user_id();
+    if (!user_id.empty()) {
+      record_write(user_key(user_id), until);
+    }
+  }
+
+ private:
+  struct Replica {
+    DatabasePtr db;
+    std::atomic<bool> healthy{false};
+  };
+
+  struct WriteShard {
+    std::shared_mutex mutex;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+        writes;
+  };
+
+  static std::string user_key(const std::string& user_id) {
+    return user_id.empty() ? user_id : "user:" + user_id;
+  }
+
+  WriteShard& write_shard(const std::string& key) {
+    return _write_shards[std::hash<std::string>()(key) % _write_shards.size()];
+  }
+
+  void record_write(const std::string& key,
+                    const std::chrono::steady_clock::time_point& until) {
+    auto& shard = write_shard(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.writes[key] = until;
+  }
+
+  // 过期记录由后台线程定期清理，读路径不修改分片
+  bool recently_written(const std::string& key) {
+    if (key.empty()) {
+      return false;
+    }
+    auto& shard = write_shard(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.writes.find(key);
+    return it != shard.writes.end() &&
+           it->second >= std::chrono::steady_clock::now();
+  }
+
+  void run() {
+    auto interval = std::clamp(_max_lag / 2, std::chrono::milliseconds(100),
+                               std::chrono::milliseconds(1000));
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+      lock.unlock();
+      heartbeat();
+      check();
+      prune();
+      lock.lock();
+      _cond.wait_for(lock, interval, [this]() { return _stop; });
+    }
+  }
+
+  void heartbeat() {
+    try {
+      odb::transaction t(_primary->begin());
+      _primary->execute(
+          "REPLACE INTO `heartbeat` (`id`, `ts`) VALUES (1, NOW(6))");
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("主库心跳写入失败: {}", e.what());
+    }
+  }
+
+  void check() {
+    for (size_t i = 0; i < _replicas.size(); ++i) {
+      auto& replica = _replicas[i];
+      bool healthy = false;
+      long long lag = -1;
+      try {
+        odb::transaction t(replica->db->begin());
+        auto result = replica->db->query<ReplicaLag>();
+        for (const auto& row : result) {
+          lag = row.lag;
+        }
+        t.commit();
+        healthy = lag >= 0 &&
+                  lag <= std::chrono::duration_cast<std::chrono::microseconds>(
+                             _max_lag)
+                             .count();
+      } catch (const std::exception& e) {
+        LOG_WARN("从库 {} 延迟检测失败: {}", i, e.what());
+      }
+
+      if (replica->healthy.exchange(healthy) != healthy) {
+        if (healthy) {
+          LOG_INFO("从库 {} 恢复读流量，延迟 {}us", i, lag);
+        } else {
+          LOG_WARN("从库 {} 摘除读流量，延迟 {}us", i, lag);
+        }
+      }
+    }
+  }
+
+  void prune() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto& shard : _write_shards) {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (auto it = shard.writes.begin(); it != shard.writes.end();) {
+        if (it->second < now) {
+          it = shard.writes.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+
+ private:
+  DatabasePtr _primary;
+  std::vector<std::unique_ptr<Replica>> _replicas;
+  std::atomic<size_t> _next{0};
+  std::chrono::milliseconds _max_lag;
+  std::chrono::milliseconds _ryw_window;
+
+  std::array<WriteShard, 64> _write_shards;
+
+  bool _stop = false;
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  std::thread _thread;
+};
+
+class ReplicatedDatabaseFactory {
+ public:
+  // replica_hosts 为逗号分隔的从库 host:port 列表，为空时读写都走主库
+  static ReplicatedDatabase::Ptr create(
+      const std::string& user, const std::string& passwd, const std::string& db,
+      const std::string& host, size_t port, const std::string& replica_hosts,
+      const std::string& charset, size_t max_connections,
+      size_t min_connections, int max_lag, int ryw_window) {
+    auto hosts = MysqlClientFactory::parse(replica_hosts);
+    return create(user, passwd, db, host, port, hosts, charset,
+                  max_connections, min_connections, max_lag, ryw_window);
+  }
+
+  static ReplicatedDatabase::Ptr create(
+      const std::string& user, const std::string& passwd, const std::string& db,
+      const std::string& host, size_t port,
+      const std::vector<std::pair<std::string, size_t>>& replica_hosts,
+      const std::string& charset, size_t max_connections,
+      size_t min_connections, int max_lag, int ryw_window) {
+    auto primary =
+        MysqlClientFactory::create(user, passwd, db, host, port, charset,
+                                   max_connections, min_connections);
+    std::vector<ReplicatedDatabase::DatabasePtr> replicas;
+    for (const auto& [replica_host, replica_port] : replica_hosts) {
+      replicas.push_back(MysqlClientFactory::create(
+          user, passwd, db, replica_host, replica_port, charset,
+          max_connections, min_connections));
+    }
+    return std::make_shared<ReplicatedDatabase>(
+        primary, replicas, std::chrono::milliseconds(max_lag),
+        std::chrono::milliseconds(ryw_window));
+  }
+};
+
+}  // namespace huzch
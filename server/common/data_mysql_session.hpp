@@ -1,5 +1,5 @@
 #pragma once
-#include "data_mysql.hpp"
+#include "data_mysql_shard.hpp"
 #include "logger.hpp"
 #include "session-odb.hxx"
 #include "session.hxx"
@@ -11,14 +11,16 @@ class SessionTable {
   using Ptr = std::shared_ptr<SessionTable>;
 
  public:
-  SessionTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  SessionTable(const ShardedDatabase::Ptr& db) : _mysql_client(db) {}
 
   bool insert(Session& session) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->persist(session);
+      auto& shard = _mysql_client->shard(session.session_id());
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->persist(session);
       t.commit();
+      shard->mark_write(session.session_id());
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 新增失败: {}", session.session_name(), e.what());
       return false;
@@ -28,12 +30,14 @@ class SessionTable {
 
   bool remove(const std::string& session_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<Session>(odb::query<Session>::session_id ==
-                                          session_id);
-      _mysql_client->erase_query<SessionMember>(
+      auto& shard = _mysql_client->shard(session_id);
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<Session>(odb::query<Session>::session_id == session_id);
+      db->erase_query<SessionMember>(
           odb::query<SessionMember>::session_id == session_id);
       t.commit();
+      shard->mark_write(session_id);
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 移除失败: {}", session_id, e.what());
       return false;
@@ -43,8 +47,9 @@ class SessionTable {
 
   std::shared_ptr<Session> select(const std::string& session_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto session = _mysql_client->query_one<Session>(
+      auto& db = _mysql_client->shard(session_id)->replica(session_id);
+      odb::transaction t(db->begin());
+      auto session = db->query_one<Session>(
           odb::query<Session>::session_id == session_id);
       t.commit();
       return std::shared_ptr<Session>(session);
@@ -54,47 +59,56 @@ class SessionTable {
     }
   }
 
+  // 用户参与的会话分布在各个分片上，需要散射-聚集
   std::vector<SingleSession> single_sessions(const std::string& user_id) {
-    std::vector<SingleSession> sessions;
-    try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<SingleSession>(
-          odb::query<SingleSession>::Session::session_type ==
-              SessionType::SINGLE &&
-          odb::query<SingleSession>::m1::user_id == user_id &&
-          odb::query<SingleSession>::m2::user_id != user_id);
-      sessions.reserve(result.size());
-      for (const auto& session : result) {
-        sessions.push_back(session);
-      }
-      t.commit();
-    } catch (const std::exception& e) {
-      LOG_ERROR("用户 {} 单聊会话查询失败: {}", user_id, e.what());
-    }
-    return sessions;
+    return _mysql_client->gather<SingleSession>(
+        [&user_id](const ShardedDatabase::DatabasePtr& shard) {
+          std::vector<SingleSession> sessions;
+          try {
+            auto& db = shard->replica(user_id);
+            odb::transaction t(db->begin());
+            auto result = db->query<SingleSession>(
+                odb::query<SingleSession>::Session::session_type ==
+                    SessionType::SINGLE &&
+                odb::query<SingleSession>::m1::user_id == user_id &&
+                odb::query<SingleSession>::m2::user_id != user_id);
+            sessions.reserve(result.size());
+            for (const auto& session : result) {
+              sessions.push_back(session);
+            }
+            t.commit();
+          } catch (const std::exception& e) {
+            LOG_ERROR("用户 {} 单聊会话查询失败: {}", user_id, e.what());
+          }
+          return sessions;
+        });
   }
 
   std::vector<GroupSession> group_sessions(const std::string& user_id) {
-    std::vector<GroupSession> sessions;
-    try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<GroupSession>(
-          odb::query<GroupSession>::Session::session_type ==
-              SessionType::GROUP &&
-          odb::query<GroupSession>::m::user_id == user_id);
-      sessions.reserve(result.size());
-      for (const auto& session : result) {
-        sessions.push_back(session);
-      }
-      t.commit();
-    } catch (const std::exception& e) {
-      LOG_ERROR("用户 {} 群聊会话查询失败: {}", user_id, e.what());
-    }
-    return sessions;
+    return _mysql_client->gather<GroupSession>(
+        [&user_id](const ShardedDatabase::DatabasePtr& shard) {
+          std::vector<GroupSession> sessions;
+          try {
+            auto& db = shard->replica(user_id);
+            odb::transaction t(db->begin());
+            auto result = db->query<GroupSession>(
+                odb::query<GroupSession>::Session::session_type ==
+                    SessionType::GROUP &&
+                odb::query<GroupSession>::m::user_id == user_id);
+            sessions.reserve(result.size());
+            for (const auto& session : result) {
+              sessions.push_back(session);
+            }
+            t.commit();
+          } catch (const std::exception& e) {
+            LOG_ERROR("用户 {} 群聊会话查询失败: {}", user_id, e.what());
+          }
+          return sessions;
+        });
   }
 
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ShardedDatabase::Ptr _mysql_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
@@ -1,5 +1,5 @@
 #pragma once
-#include "data_mysql.hpp"
+#include "data_mysql_shard.hpp"
 #include "logger.hpp"
 #include "session_member-odb.hxx"
 #include "session_member.hxx"
@@ -11,14 +11,17 @@ class SessionMemberTable {
   using Ptr = std::shared_ptr<SessionMemberTable>;
 
  public:
-  SessionMemberTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  SessionMemberTable(const ShardedDatabase::Ptr& db) : _mysql_client(db) {}
 
   bool insert(SessionMember& member) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->persist(member);
+      auto& shard = _mysql_client->shard(member.session_id());
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->persist(member);
       t.commit();
+      shard->mark_write(member.session_id());
+      shard->mark_write(member.user_id());
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 新增单个成员 {} 失败: {}", member.session_id(),
                 member.user_id(), e.what());
@@ -27,13 +30,23 @@ class SessionMemberTable {
     return true;
   }
 
+  // 批量新增的成员属于同一会话，落在同一分片
   bool insert(std::vector<SessionMember>& members) {
+    if (members.empty()) {
+      return true;
+    }
     try {
-      odb::transaction t(_mysql_client->begin());
+      auto& shard = _mysql_client->shard(members[0].session_id());
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
       for (auto& member : members) {
-        _mysql_client->persist(member);
+        db->persist(member);
       }
       t.commit();
+      shard->mark_write(members[0].session_id());
+      for (auto& member : members) {
+        shard->mark_write(member.user_id());
+      }
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 新增 {} 个成员失败: {}", members[0].session_id(),
                 members.size(), e.what());
@@ -44,11 +57,15 @@ class SessionMemberTable {
 
   bool remove(const std::string& session_id, const std::string& user_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<SessionMember>(
+      auto& shard = _mysql_client->shard(session_id);
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<SessionMember>(
           odb::query<SessionMember>::session_id == session_id &&
           odb::query<SessionMember>::user_id == user_id);
       t.commit();
+      shard->mark_write(session_id);
+      shard->mark_write(user_id);
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 移除单个成员 {} 失败: {}", session_id, user_id,
                 e.what());
@@ -59,10 +76,13 @@ class SessionMemberTable {
 
   bool remove(const std::string& session_id) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->erase_query<SessionMember>(
+      auto& shard = _mysql_client->shard(session_id);
+      auto& db = shard->primary();
+      odb::transaction t(db->begin());
+      db->erase_query<SessionMember>(
           odb::query<SessionMember>::session_id == session_id);
       t.commit();
+      shard->mark_write(session_id);
     } catch (const std::exception& e) {
       LOG_ERROR("会话 {} 移除所有成员失败: {}", session_id, e.what());
       return false;
@@ -70,11 +90,16 @@ class SessionMemberTable {
     return true;
   }
 
-  std::vector<SessionMember> members(const std::string& session_id) {
+  // primary 为true时读主库，用于回填成员缓存：缓存虽有过期时间，但从库
+  // 偏旧的成员列表一经回填，新加入的成员在整个过期时间内都收不到消息
+  std::vector<SessionMember> members(const std::string& session_id,
+                                     bool primary = false) {
     std::vector<SessionMember> members;
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto result = _mysql_client->query<SessionMember>(
+      auto& shard = _mysql_client->shard(session_id);
+      auto& db = primary ? shard->primary() : shard->replica(session_id);
+      odb::transaction t(db->begin());
+      auto result = db->query<SessionMember>(
           odb::query<SessionMember>::session_id == session_id);
       members.reserve(result.size());
       for (const auto& member : result) {
@@ -89,7 +114,7 @@ class SessionMemberTable {
   }
 
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ShardedDatabase::Ptr _mysql_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+#include <bthread/bthread.h>
+
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include "data_mysql_replica.hpp"
+
+namespace huzch {
+
+// 按会话分片的数据库路由
+// session、session_member、message 三张表按 session_id 共置于同一分片，
+// 其余全局表(user、relation、friend_request)只存在于全局库
+// 每个分片及全局库均为一主多从
+class ShardedDatabase {
+ public:
+  using Ptr = std::shared_ptr<ShardedDatabase>;
+  using DatabasePtr = ReplicatedDatabase::Ptr;
+
+ public:
+  ShardedDatabase(const DatabasePtr& global,
+                  const std::vector<DatabasePtr>& shards)
+      : _global(global), _shards(shards) {
+    if (_shards.empty()) {
+      _shards.push_back(_global);
+    }
+  }
+
+  const DatabasePtr& global() const { return _global; }
+
+  size_t size() const { return _shards.size(); }
+
+  const DatabasePtr& shard(size_t index) const { return _shards[index]; }
+
+  const DatabasePtr& shard(const std::string& session_id) const {
+    return _shards[index(session_id, _shards.size())];
+  }
+
+  // 散射-聚集：在所有分片上并发执行查询并合并结果
+  // 除第一个分片外每个分片一个 bthread，当前 bthread 执行第一个分片；
+  // 后台 bthread 不继承当前 span 与请求上下文，由任务显式携带
+  template <typename T, typename F>
+  std::vector<T> gather(F&& fn) const {
+    if (_shards.size() == 1) {
+      return fn(_shards[0]);
+    }
+
+    using Task = GatherTask<T, std::remove_reference_t<F>>;
+    std::vector<Task> tasks(_shards.size());
+    std::vector<bthread_t> tids(_shards.size(), INVALID_BTHREAD);
+    for (size_t i = 0; i < _shards.size(); ++i) {
+      tasks[i].fn = &fn;
+      tasks[i].shard = &_shards[i];
+      tasks[i].parent = Span::current();
+      tasks[i].request_id = RequestContext::request_id();
+      tasks[i].user_id = RequestContext::user_id();
+      if (i == 0 ||
+          bthread_start_background(&tids[i], nullptr, &Task::run,
+                                   &tasks[i]) != 0) {
+        tids[i] = INVALID_BTHREAD;
+      }
+    }
+    for (size_t i = 0; i < _shards.size(); ++i) {
+      if (tids[i] == INVALID_BTHREAD) {
+        Task::run(&tasks[i]);
+      }
+    }
+
+    std::vector<T> results;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+      if (tids[i] != INVALID_BTHREAD) {
+        bthread_join(tids[i], nullptr);
+      }
+      results.insert(results.end(),
+                     std::make_move_iterator(tasks[i].result.begin()),
+                     std::make_move_iterator(tasks[i].result.end()));
+    }
+    return results;
+  }
+
+  // FNV-1a 哈希 + 跳跃一致性哈希，分片数增加时只迁移约 1/N 的会话
+  static size_t index(const std::string& session_id, size_t shards) {
+    uint64_t key = 14695981039346656037ULL;
+    for (unsigned char c : session_id) {
+      key ^= c;
+      key *= 1099511628211ULL;
+    }
+
+    int64_t b = -1, j = 0;
+    while (j < static_cast<int64_t>(shards)) {
+      b = j;
+      key = key * 2862933555777941757ULL + 1;
+      j = static_cast<int64_t>((b + 1) * (static_cast<double>(1LL << 31) /
+                                          static_cast<double>((key >> 33) + 1)));
+    }
+    return static_cast<size_t>(b);
+  }
+
+ private:
+  template <typename T, typename F>
+  struct GatherTask {
+    F* fn = nullptr;
+    const DatabasePtr* shard = nullptr;
+    Span* parent = nullptr;
+    std::string request_id;
+    std::string user_id;
+    std::vector<T> result;
+
+    static void* run(void* arg) {
+      auto task = static_cast<GatherTask*>(arg);
+      Span span("gather", task->parent);
+      SpanScope scope(&span);
+      RequestScope request(task->request_id, task->user_id);
+      task->result = (*task->fn)(*task->shard);
+      return nullptr;
+    }
+  };
+
+  DatabasePtr _global;
+  std::vector<DatabasePtr> _shards;
+};
+
+class ShardedDatabaseFactory {
+ public:
+  // shard_hosts 为逗号分隔的分片列表，每个分片为 主库|从库|从库 形式的
+  // host:port 列表；为空时所有表都使用全局库
+  static ShardedDatabase::Ptr create(
+      const std::string& user, const std::string& passwd, const std::string& db,
+      const std::string& host, size_t port, const std::string& replica_hosts,
+      const std::string& shard_hosts, const std::string& charset,
+      size_t max_connections, size_t min_connections, int max_lag,
+      int ryw_window) {
+    auto global = ReplicatedDatabaseFactory::create(
+        user, passwd, db, host, port, replica_hosts, charset, max_connections,
+        min_connections, max_lag, ryw_window);
+    std::vector<ShardedDatabase::DatabasePtr> shards;
+    std::stringstream ss(shard_hosts);
+    std::string shard;
+    while (std::getline(ss, shard, ',')) {
+      auto hosts = MysqlClientFactory::parse(shard, '|');
+      if (hosts.empty()) {
+        continue;
+      }
+      std::vector<std::pair<std::string, size_t>> replicas(hosts.begin() + 1,
+                                                           hosts.end());
+      shards.push_back(ReplicatedDatabaseFactory::create(
+          user, passwd, db, hosts[0].first, hosts[0].second, replicas, charset,
+          max_connections, min_connections, max_lag, ryw_window));
+    }
+    return std::make_shared<ShardedDatabase>(global, shards);
+  }
+};
+
+}  // namespace huzch
@@ -1,5 +1,5 @@
 #pragma once
-#include "data_mysql.hpp"
+#include "data_mysql_replica.hpp"
 #include "logger.hpp"
 #include "user-odb.hxx"
 #include "user.hxx"
@@ -11,14 +11,15 @@ class UserTable {
   using Ptr = std::shared_ptr<UserTable>;
 
  public:
-  UserTable(const std::shared_ptr<odb::core::database>& db)
-      : _mysql_client(db) {}
+  UserTable(const ReplicatedDatabase::Ptr& db) : _mysql_client(db) {}
 
   bool insert(const std::shared_ptr<User>& user) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->persist(*user);
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
+      db->persist(*user);
       t.commit();
+      mark_write(*user);
     } catch (const std::exception& e) {
       LOG_ERROR("用户 {} 新增失败: {}", user->name(), e.what());
       return false;
@@ -28,9 +29,11 @@ class UserTable {
 
   bool update(const std::shared_ptr<User>& user) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      _mysql_client->update(*user);
+      auto& db = _mysql_client->primary();
+      odb::transaction t(db->begin());
+      db->update(*user);
       t.commit();
+      mark_write(*user);
     } catch (const std::exception& e) {
       LOG_ERROR("用户 {} 更新失败: {}", user->name(), e.what());
       return false;
@@ -40,9 +43,9 @@ class UserTable {
 
   std::shared_ptr<User> select_by_name(const std::string& name) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto user =
-          _mysql_client->query_one<User>(odb::query<User>::name == name);
+      auto& db = _mysql_client->replica(name);
+      odb::transaction t(db->begin());
+      auto user = db->query_one<User>(odb::query<User>::name == name);
       t.commit();
       return std::shared_ptr<User>(user);
     } catch (const std::exception& e) {
@@ -53,9 +56,9 @@ class UserTable {
 
   std::shared_ptr<User> select_by_phone(const std::string& phone) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto user =
-          _mysql_client->query_one<User>(odb::query<User>::phone == phone);
+      auto& db = _mysql_client->replica(phone);
+      odb::transaction t(db->begin());
+      auto user = db->query_one<User>(odb::query<User>::phone == phone);
       t.commit();
       return std::shared_ptr<User>(user);
     } catch (const std::exception& e) {
@@ -64,11 +67,14 @@ class UserTable {
     }
   }
 
-  std::shared_ptr<User> select_by_id(const std::string& user_id) {
+  // primary 为true时读主库，用于返回与版本号配对的资料，从库可能偏旧
+  std::shared_ptr<User> select_by_id(const std::string& user_id,
+                                     bool primary = false) {
     try {
-      odb::transaction t(_mysql_client->begin());
-      auto user =
-          _mysql_client->query_one<User>(odb::query<User>::user_id == user_id);
+      auto& db = primary ? _mysql_client->primary()
+                         : _mysql_client->replica(user_id);
+      odb::transaction t(db->begin());
+      auto user = db->query_one<User>(odb::query<User>::user_id == user_id);
       t.commit();
       return std::shared_ptr<User>(user);
     } catch (const std::exception& e) {
@@ -77,11 +83,15 @@ class UserTable {
     }
   }
 
+  // primary 含义同 select_by_id；批量查询多为好友、成员列表展示，
+  // 不与版本号配对时不要求读己之写，可读从库
   std::vector<User> select_by_multi_id(
-      const std::vector<std::string>& users_id) {
+      const std::vector<std::string>& users_id, bool primary = false) {
     std::vector<User> users;
     try {
-      odb::transaction t(_mysql_client->begin());
+      auto& db = primary ? _mysql_client->primary()
+                         : _mysql_client->replica(std::string());
+      odb::transaction t(db->begin());
 
       std::string condition = "user_id in (";
       for (const auto& user_id : users_id) {
@@ -89,9 +99,11 @@ class UserTable {
       }
       condition.pop_back();
       condition += ")";
-      LOG_DEBUG("condition: {}", condition);
+      LOG_EVENT_LIMITED(debug, 10, RequestContext::request_id(),
+                        "mysql_select_users", "count",
+                        users_id.size());
 
-      auto result = _mysql_client->query<User>(condition);
+      auto result = db->query<User>(condition);
       users.reserve(result.size());
       for (const auto& user : result) {
         users.push_back(user);
@@ -104,7 +116,19 @@ class UserTable {
   }
 
  private:
-  std::shared_ptr<odb::core::database> _mysql_client;
+  // 用户可按 id、昵称、手机号查询，三者都需开启读己之写窗口
+  void mark_write(const User& user) {
+    _mysql_client->mark_write(user.user_id());
+    if (!user.name().empty()) {
+      _mysql_client->mark_write(user.name());
+    }
+    if (!user.phone().empty()) {
+      _mysql_client->mark_write(user.phone());
+    }
+  }
+
+ private:
+  ReplicatedDatabase::Ptr _mysql_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
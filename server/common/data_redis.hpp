@@ -1,70 +1,405 @@
 #pragma once
-#include <sw/redis++/redis.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <unordered_map>
+
+#include "logger.hpp"
+#include "redis.hpp"
 
 namespace huzch {
 
-class RedisClientFactory {
+// redis键命名规范：ichat:<类型>:<id>
+// 在线状态按 user_id 哈希分桶打包进小哈希 ichat:online:{桶号}，每个在线用户只占
+// 哈希中的一个字段，而不是一个顶层键；桶数量使小哈希保持紧凑编码
+// 登录会话id以所属用户的桶号开头，会话键 ichat:sess:{桶号}:<会话id> 与在线状态
+// 共用同一个哈希标签，集群模式下两者位于同一槽位，可在同一个lua脚本中原子操作
+class KeySchema {
  public:
-  static std::shared_ptr<sw::redis::Redis> create(const std::string& host,
-                                                  int port, int db,
-                                                  bool keep_alive) {
-    sw::redis::ConnectionOptions options;
-    options.host = host;
-    options.port = port;
-    options.db = db;
-    options.keep_alive = keep_alive;
-    return std::make_shared<sw::redis::Redis>(options);
+  static constexpr size_t BUCKETS = 16384;
+  static constexpr size_t TAG_LEN = 4;
+
+  static size_t bucket(const std::string& user_id) {
+    uint32_t hash = 2166136261u;
+    for (unsigned char c : user_id) {
+      hash ^= c;
+      hash *= 16777619u;
+    }
+    return hash % BUCKETS;
+  }
+
+  // 以用户桶号(4位16进制)为前缀生成登录会话id
+  static std::string session_id(const std::string& user_id,
+                                const std::string& unique) {
+    return tag(bucket(user_id)) + unique;
+  }
+
+  static std::string online(const std::string& user_id) {
+    return "ichat:online:{" + tag(bucket(user_id)) + "}";
+  }
+
+  static std::string online(size_t bucket) {
+    return "ichat:online:{" + tag(bucket) + "}";
+  }
+
+  static std::string session(const std::string& session_id) {
+    return "ichat:sess:{" + session_id.substr(0, TAG_LEN) + "}:" + session_id;
+  }
+
+  static std::string code(const std::string& code_id) {
+    return "ichat:code:" + code_id;
+  }
+
+ private:
+  static std::string tag(size_t bucket) {
+    static const char digits[] = "0123456789abcdef";
+    std::string tag(TAG_LEN, '0');
+    for (size_t i = TAG_LEN; i > 0; --i) {
+      tag[i - 1] = digits[bucket & 0xf];
+      bucket >>= 4;
+    }
+    return tag;
   }
 };
 
+inline long long now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
 // 登录会话
 class Session {
  public:
   using Ptr = std::shared_ptr<Session>;
 
  public:
-  Session(const std::shared_ptr<sw::redis::Redis>& redis_client)
+  Session(const RedisClient::Ptr& redis_client)
       : _redis_client(redis_client) {}
 
-  bool insert(const std::string& session_id, const std::string& user_id) {
-    return _redis_client->set(session_id, user_id);
-  }
-
+  // 会话可能已过期，键不存在同样视为移除成功，只有redis出错时返回false
   bool remove(const std::string& session_id) {
-    return _redis_client->del(session_id);
+    std::string key = KeySchema::session(session_id);
+    try {
+      _redis_client->run([&](auto& redis) { return redis.del(key); });
+    } catch (const std::exception& e) {
+      LOG_ERROR("登录会话移除失败: {}", e.what());
+      return false;
+    }
+    return true;
   }
 
+  // 每个http请求都会校验登录会话，允许时优先读从库
   sw::redis::OptionalString user_id(const std::string& session_id) {
-    return _redis_client->get(session_id);
+    std::string key = KeySchema::session(session_id);
+    auto user_id =
+        _redis_client->read([&](auto& redis) { return redis.get(key); });
+    if (!user_id && _redis_client->has_replica()) {
+      // 刚登录的会话可能尚未复制到从库，未命中时回主库确认
+      user_id = _redis_client->run([&](auto& redis) { return redis.get(key); });
+    }
+    return user_id;
   }
 
  private:
-  std::shared_ptr<sw::redis::Redis> _redis_client;
+  RedisClient::Ptr _redis_client;
 };
 
-// 登录状态
+// 登录状态：桶哈希中 user_id -> 过期时刻(毫秒时间戳，0表示不过期)
+// 哈希字段无法单独设置过期时间，过期字段由 purge 定期清理
 class Status {
  public:
   using Ptr = std::shared_ptr<Status>;
 
  public:
-  Status(const std::shared_ptr<sw::redis::Redis>& redis_client)
+  Status(const RedisClient::Ptr& redis_client)
       : _redis_client(redis_client) {}
 
-  bool insert(const std::string& user_id) {
-    return _redis_client->set(user_id, "");
-  }
-
+  // 字段可能已被 purge 清理，不存在同样视为移除成功
   bool remove(const std::string& user_id) {
-    return _redis_client->del(user_id);
+    std::string key = KeySchema::online(user_id);
+    try {
+      _redis_client->run(
+          [&](auto& redis) { return redis.hdel(key, user_id); });
+    } catch (const std::exception& e) {
+      LOG_ERROR("登录状态移除失败: {}", e.what());
+      return false;
+    }
+    return true;
   }
 
   bool exists(const std::string& user_id) {
-    return _redis_client->exists(user_id);
+    std::string key = KeySchema::online(user_id);
+    auto expire = _redis_client->run(
+        [&](auto& redis) { return redis.hget(key, user_id); });
+    if (!expire) {
+      return false;
+    }
+    long long at = std::stoll(*expire);
+    return at == 0 || at > now_ms();
+  }
+
+  // 清理 [begin, begin + count) 号桶中已过期的字段，返回清理的字段数
+  long long purge(size_t begin, size_t count) {
+    long long purged = 0;
+    std::vector<std::string> args = {std::to_string(now_ms())};
+    for (size_t i = 0; i < count; ++i) {
+      std::vector<std::string> keys = {
+          KeySchema::online((begin + i) % KeySchema::BUCKETS)};
+      try {
+        purged += _redis_client->run([&](auto& redis) {
+          return redis.template eval<long long>(_purge_script, keys.begin(),
+                                                keys.end(), args.begin(),
+                                                args.end());
+        });
+      } catch (const std::exception& e) {
+        LOG_ERROR("登录状态过期字段清理失败: {}", e.what());
+        break;
+      }
+    }
+    return purged;
+  }
+
+ private:
+  const std::string _purge_script = R"(
+local now = tonumber(ARGV[1])
+local fields = redis.call('HGETALL', KEYS[1])
+local purged = 0
+for i = 1, #fields, 2 do
+  local at = tonumber(fields[i + 1])
+  if at > 0 and at < now then
+    redis.call('HDEL', KEYS[1], fields[i])
+    purged = purged + 1
+  end
+end
+return purged
+)";
+  RedisClient::Ptr _redis_client;
+};
+
+// 在线状态查询与变化广播
+// 查询时按在线状态桶分组，每个桶一条 HMGET，单节点模式下合并为一次 pipeline；
+// 各网关把一个合并周期内的状态变化打包成 user_id:0/1,... 发布到同一频道
+class Presence {
+ public:
+  using Ptr = std::shared_ptr<Presence>;
+
+ public:
+  Presence(const RedisClient::Ptr& redis_client)
+      : _redis_client(redis_client) {}
+
+  bool query(const std::vector<std::string>& users_id,
+             std::unordered_map<std::string, bool>& presence) {
+    std::unordered_map<size_t, std::vector<std::string>> buckets;
+    for (const auto& user_id : users_id) {
+      buckets[KeySchema::bucket(user_id)].push_back(user_id);
+    }
+
+    std::vector<std::vector<sw::redis::OptionalString>> values(buckets.size());
+    try {
+      if (_redis_client->cluster()) {
+        // 集群模式下各桶位于不同槽位，逐桶读取
+        size_t i = 0;
+        for (const auto& [bucket, fields] : buckets) {
+          std::string key = KeySchema::online(bucket);
+          _redis_client->run([&](auto& redis) {
+            redis.hmget(key, fields.begin(), fields.end(),
+                        std::back_inserter(values[i]));
+          });
+          ++i;
+        }
+      } else {
+        auto pipe = _redis_client->pipeline("");
+        for (const auto& [bucket, fields] : buckets) {
+          pipe.hmget(KeySchema::online(bucket), fields.begin(), fields.end());
+        }
+        auto replies = pipe.exec();
+        for (size_t i = 0; i < buckets.size(); ++i) {
+          replies.get(i, std::back_inserter(values[i]));
+        }
+      }
+    } catch (const std::exception& e) {
+      LOG_ERROR("在线状态批量查询失败: {}", e.what());
+      return false;
+    }
+
+    long long now = now_ms();
+    size_t i = 0;
+    for (const auto& [bucket, fields] : buckets) {
+      for (size_t j = 0; j < fields.size(); ++j) {
+        const auto& expire = values[i][j];
+        long long at = expire ? std::stoll(*expire) : -1;
+        presence[fields[j]] = at == 0 || at > now;
+      }
+      ++i;
+    }
+    return true;
+  }
+
+  bool publish(const std::vector<std::pair<std::string, bool>>& changes) {
+    std::string message;
+    for (const auto& [user_id, online] : changes) {
+      if (!message.empty()) {
+        message += ',';
+      }
+      message += user_id + (online ? ":1" : ":0");
+    }
+    try {
+      _redis_client->run(
+          [&](auto& redis) { return redis.publish(_channel, message); });
+    } catch (const std::exception& e) {
+      LOG_ERROR("在线状态变化广播失败: {}", e.what());
+      return false;
+    }
+    return true;
   }
 
+  static std::vector<std::pair<std::string, bool>> parse(
+      const std::string& message) {
+    std::vector<std::pair<std::string, bool>> changes;
+    std::stringstream ss(message);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      size_t pos = item.rfind(':');
+      if (pos == std::string::npos) {
+        continue;
+      }
+      changes.emplace_back(item.substr(0, pos), item.substr(pos + 1) == "1");
+    }
+    return changes;
+  }
+
+  const std::string& channel() const { return _channel; }
+
  private:
-  std::shared_ptr<sw::redis::Redis> _redis_client;
+  const std::string _channel = "ichat:presence";
+  RedisClient::Ptr _redis_client;
+};
+
+// 登录：检查登录状态、创建登录会话、标记登录状态在一个lua脚本中原子完成，
+// 只需一次往返，且并发登录同一用户时只有一个能成功
+// 两者都带过期时间，由网关按长连接心跳批量续期，网关异常退出时自然过期
+class Login {
+ public:
+  using Ptr = std::shared_ptr<Login>;
+
+ public:
+  Login(const RedisClient::Ptr& redis_client,
+        const std::chrono::milliseconds& ttl = std::chrono::milliseconds(0))
+      : _redis_client(redis_client), _ttl(ttl) {}
+
+  // session_id 须由 KeySchema::session_id 生成
+  // 成功返回1，用户已在其他地方登录返回0，失败返回-1
+  int login(const std::string& user_id, const std::string& session_id) {
+    std::vector<std::string> keys = {KeySchema::online(user_id),
+                                     KeySchema::session(session_id)};
+    std::vector<std::string> args = {user_id, std::to_string(now_ms()),
+                                     std::to_string(_ttl.count())};
+    try {
+      return _redis_client->run([&](auto& redis) {
+        return redis.template eval<long long>(_script, keys.begin(), keys.end(),
+                                              args.begin(), args.end());
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 登录写入redis失败: {}", user_id, e.what());
+      return -1;
+    }
+  }
+
+  // 续期在线用户的登录状态与登录会话，clients 为 (user_id, session_id)
+  // 每批合并为一次lua脚本调用，网关上所有连接的续期只需少量往返
+  bool renew(const std::vector<std::pair<std::string, std::string>>& clients) {
+    if (_ttl.count() == 0) {
+      return true;
+    }
+    std::string expire = std::to_string(now_ms() + _ttl.count());
+    if (!_redis_client->cluster()) {
+      for (size_t i = 0; i < clients.size(); i += _renew_batch_size) {
+        size_t end = std::min(i + _renew_batch_size, clients.size());
+        if (!renew(clients.begin() + i, clients.begin() + end, expire)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // 集群模式下脚本的键须位于同一槽位，按在线状态桶分组续期
+    auto sorted = clients;
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+      return KeySchema::bucket(a.first) < KeySchema::bucket(b.first);
+    });
+    for (auto it = sorted.begin(); it != sorted.end();) {
+      size_t bucket = KeySchema::bucket(it->first);
+      auto end = std::find_if(it, sorted.end(), [bucket](const auto& client) {
+        return KeySchema::bucket(client.first) != bucket;
+      });
+      if (!renew(it, end, expire)) {
+        return false;
+      }
+      it = end;
+    }
+    return true;
+  }
+
+ private:
+  template <typename It>
+  bool renew(It begin, It end, const std::string& expire) {
+    std::vector<std::string> keys;
+    std::vector<std::string> args = {expire, std::to_string(_ttl.count())};
+    for (auto it = begin; it != end; ++it) {
+      const auto& [user_id, session_id] = *it;
+      keys.push_back(KeySchema::online(user_id));
+      keys.push_back(KeySchema::session(session_id));
+      args.push_back(user_id);
+    }
+    try {
+      _redis_client->run([&](auto& redis) {
+        return redis.template eval<long long>(_renew_script, keys.begin(),
+                                              keys.end(), args.begin(),
+                                              args.end());
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("登录会话续期失败: {}", e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // KEYS[1] 在线状态桶，KEYS[2] 登录会话，ARGV[1] 用户id，
+  // ARGV[2] 当前毫秒时间戳，ARGV[3] 过期毫秒数(0表示不过期)
+  const std::string _script = R"(
+local now = tonumber(ARGV[2])
+local ttl = tonumber(ARGV[3])
+local at = tonumber(redis.call('HGET', KEYS[1], ARGV[1]) or '-1')
+if at == 0 or at > now then
+  return 0
+end
+if ttl > 0 then
+  redis.call('HSET', KEYS[1], ARGV[1], now + ttl)
+  redis.call('SET', KEYS[2], ARGV[1], 'PX', ttl)
+else
+  redis.call('HSET', KEYS[1], ARGV[1], 0)
+  redis.call('SET', KEYS[2], ARGV[1])
+end
+return 1
+)";
+  // KEYS 依次为 (在线状态桶, 登录会话) 对，ARGV[1] 新的过期毫秒时间戳，
+  // ARGV[2] 过期毫秒数，ARGV[2+i] 第i个用户id
+  // 只续期仍存在的状态字段：用户已下线时字段已被删除，不能重新写入，
+  // 否则该用户在整个过期时间内被判定为已在其他地方登录
+  const std::string _renew_script = R"(
+for i = 1, #KEYS / 2 do
+  local user_id = ARGV[i + 2]
+  if redis.call('HEXISTS', KEYS[2 * i - 1], user_id) == 1 then
+    redis.call('HSET', KEYS[2 * i - 1], user_id, ARGV[1])
+  end
+  redis.call('PEXPIRE', KEYS[2 * i], ARGV[2])
+end
+return 1
+)";
+  const size_t _renew_batch_size = 500;
+  RedisClient::Ptr _redis_client;
+  std::chrono::milliseconds _ttl;
 };
 
 // 登录验证码
@@ -73,25 +408,252 @@ class Code {
   using Ptr = std::shared_ptr<Code>;
 
  public:
-  Code(const std::shared_ptr<sw::redis::Redis>& redis_client)
+  Code(const RedisClient::Ptr& redis_client)
       : _redis_client(redis_client) {}
 
   bool insert(
       const std::string& code_id, const std::string& code,
       const std::chrono::milliseconds& ttl = std::chrono::milliseconds(60000)) {
-    return _redis_client->set(code_id, code, ttl);
+    std::string key = KeySchema::code(code_id);
+    return _redis_client->run(
+        [&](auto& redis) { return redis.set(key, code, ttl); });
   }
 
   bool remove(const std::string& code_id) {
-    return _redis_client->del(code_id);
+    std::string key = KeySchema::code(code_id);
+    return _redis_client->run([&](auto& redis) { return redis.del(key); });
   }
 
   sw::redis::OptionalString code(const std::string& code_id) {
-    return _redis_client->get(code_id);
+    std::string key = KeySchema::code(code_id);
+    return _redis_client->run([&](auto& redis) { return redis.get(key); });
+  }
+
+ private:
+  RedisClient::Ptr _redis_client;
+};
+
+// 离线消息收件箱
+class Inbox {
+ public:
+  using Ptr = std::shared_ptr<Inbox>;
+
+ public:
+  Inbox(const RedisClient::Ptr& redis_client, size_t max_size,
+        const std::chrono::seconds& ttl)
+      : _redis_client(redis_client), _max_size(max_size), _ttl(ttl) {}
+
+  // 追加一条离线消息，超出上限时丢弃最旧的消息
+  bool push(const std::string& user_id, const std::string& message) {
+    std::string key = _prefix + user_id;
+    try {
+      auto pipe = _redis_client->pipeline(key);
+      pipe.rpush(key, message)
+          .ltrim(key, -static_cast<long long>(_max_size), -1)
+          .expire(key, _ttl)
+          .exec();
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 离线消息写入失败: {}", user_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // 向多个离线用户的收件箱追加同一条消息，单节点模式下合并为一次 pipeline；
+  // 集群模式下各收件箱位于不同槽位，逐个写入
+  bool push(const std::vector<std::string>& users_id,
+            const std::string& message) {
+    if (users_id.empty()) {
+      return true;
+    }
+    if (_redis_client->cluster()) {
+      bool ret = true;
+      for (const auto& user_id : users_id) {
+        ret = push(user_id, message) && ret;
+      }
+      return ret;
+    }
+    try {
+      auto pipe = _redis_client->pipeline("");
+      for (const auto& user_id : users_id) {
+        std::string key = _prefix + user_id;
+        pipe.rpush(key, message)
+            .ltrim(key, -static_cast<long long>(_max_size), -1)
+            .expire(key, _ttl);
+      }
+      pipe.exec();
+    } catch (const std::exception& e) {
+      LOG_ERROR("{} 个用户离线消息写入失败: {}", users_id.size(), e.what());
+      return false;
+    }
+    return true;
+  }
+
+  // 读取收件箱中的全部消息，不删除
+  bool peek(const std::string& user_id, std::vector<std::string>& messages) {
+    std::string key = _prefix + user_id;
+    try {
+      _redis_client->run([&](auto& redis) {
+        redis.lrange(key, 0, -1, std::back_inserter(messages));
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 离线消息读取失败: {}", user_id, e.what());
+      return false;
+    }
+    return true;
   }
 
+  // 删除最旧的 count 条已推送消息，读取后新追加的消息保留在尾部
+  bool trim(const std::string& user_id, size_t count) {
+    if (count == 0) {
+      return true;
+    }
+    std::string key = _prefix + user_id;
+    try {
+      _redis_client->run([&](auto& redis) {
+        redis.ltrim(key, static_cast<long long>(count), -1);
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 已推送离线消息删除失败: {}", user_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  const std::string _prefix = "inbox_";
+  RedisClient::Ptr _redis_client;
+  size_t _max_size;
+  std::chrono::seconds _ttl;
+};
+
+// 会话消息序号
+class Sequence {
+ public:
+  using Ptr = std::shared_ptr<Sequence>;
+
+ public:
+  Sequence(const RedisClient::Ptr& redis_client)
+      : _redis_client(redis_client) {}
+
+  // 原子分配会话内下一个序号；计数器不存在(新会话或redis数据丢失)时
+  // 不自行从1开始，返回0由调用方从mysql恢复后 seed；失败返回-1
+  long long next(const std::string& session_id) {
+    try {
+      std::vector<std::string> keys = {_prefix + session_id};
+      std::vector<std::string> args;
+      return _redis_client->run([&](auto& redis) {
+        return redis.template eval<long long>(_next_script, keys.begin(),
+                                              keys.end(), args.begin(),
+                                              args.end());
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 分配消息序号失败: {}", session_id, e.what());
+      return -1;
+    }
+  }
+
+  // 以已持久化的最大序号初始化计数器，并发恢复时只有一个生效
+  bool seed(const std::string& session_id, unsigned long long seq) {
+    try {
+      std::string key = _prefix + session_id;
+      _redis_client->run([&](auto& redis) {
+        return redis.set(key, std::to_string(seq),
+                         std::chrono::milliseconds(0),
+                         sw::redis::UpdateType::NOT_EXIST);
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 消息序号恢复失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  const std::string _prefix = "seq_";
+  const std::string _next_script = R"(
+if redis.call('EXISTS', KEYS[1]) == 0 then
+  return 0
+end
+return redis.call('INCR', KEYS[1])
+)";
+  RedisClient::Ptr _redis_client;
+};
+
+// 用户资料版本
+// 资料变更时递增版本号并广播 user_id:version，缓存据此淘汰旧资料
+class ProfileVersion {
+ public:
+  using Ptr = std::shared_ptr<ProfileVersion>;
+
+ public:
+  ProfileVersion(const RedisClient::Ptr& redis_client)
+      : _redis_client(redis_client) {}
+
+  // 递增版本号并广播，失败返回-1
+  long long bump(const std::string& user_id) {
+    try {
+      std::string key = _prefix + user_id;
+      return _redis_client->run([&](auto& redis) {
+        long long version = redis.incr(key);
+        redis.publish(_channel, user_id + ":" + std::to_string(version));
+        return version;
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 资料版本递增失败: {}", user_id, e.what());
+      return -1;
+    }
+  }
+
+  // 资料从未变更过的用户版本为0，失败返回-1
+  long long version(const std::string& user_id) {
+    try {
+      std::string key = _prefix + user_id;
+      auto version =
+          _redis_client->run([&](auto& redis) { return redis.get(key); });
+      return version ? std::stoll(*version) : 0;
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户 {} 资料版本读取失败: {}", user_id, e.what());
+      return -1;
+    }
+  }
+
+  bool versions(const std::vector<std::string>& users_id,
+                std::unordered_map<std::string, long long>& versions) {
+    std::vector<std::string> keys;
+    keys.reserve(users_id.size());
+    for (const auto& user_id : users_id) {
+      keys.push_back(_prefix + user_id);
+    }
+    std::vector<sw::redis::OptionalString> values;
+    try {
+      if (_redis_client->cluster()) {
+        // 集群模式下 mget 不能跨槽位，逐个读取
+        for (const auto& key : keys) {
+          values.push_back(
+              _redis_client->run([&](auto& redis) { return redis.get(key); }));
+        }
+      } else {
+        _redis_client->run([&](auto& redis) {
+          redis.mget(keys.begin(), keys.end(), std::back_inserter(values));
+        });
+      }
+    } catch (const std::exception& e) {
+      LOG_ERROR("用户资料版本批量读取失败: {}", e.what());
+      return false;
+    }
+    for (size_t i = 0; i < users_id.size(); ++i) {
+      versions[users_id[i]] = values[i] ? std::stoll(*values[i]) : 0;
+    }
+    return true;
+  }
+
+  const std::string& channel() const { return _channel; }
+
  private:
-  std::shared_ptr<sw::redis::Redis> _redis_client;
+  const std::string _prefix = "profile_ver_";
+  const std::string _channel = "profile_invalidate";
+  RedisClient::Ptr _redis_client;
 };
 
 }  // namespace huzch
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+#include "logger.hpp"
+#include "redis.hpp"
+
+namespace huzch {
+
+// 会话成员集合
+// 每个会话对应一个 set，成员变更时整体重写并通过频道广播失效通知，
+// 各转发服务据此淘汰本地缓存；集合带过期时间，偶发写入的旧成员不会长期保留
+class Members {
+ public:
+  using Ptr = std::shared_ptr<Members>;
+
+ public:
+  Members(const RedisClient::Ptr& redis_client,
+          const std::chrono::seconds& ttl = std::chrono::seconds(86400))
+      : _redis_client(redis_client), _ttl(ttl) {}
+
+  // 会话至少有一个成员，集合为空即视为未缓存
+  bool get(const std::string& session_id, std::vector<std::string>& users_id) {
+    try {
+      std::string key = _prefix + session_id;
+      _redis_client->run([&](auto& redis) {
+        redis.smembers(key, std::back_inserter(users_id));
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 成员读取失败: {}", session_id, e.what());
+      return false;
+    }
+    return !users_id.empty();
+  }
+
+  bool insert(const std::string& session_id,
+              const std::vector<std::string>& users_id) {
+    std::string key = _prefix + session_id;
+    try {
+      auto tx = _redis_client->transaction(key);
+      tx.del(key)
+          .sadd(key, users_id.begin(), users_id.end())
+          .expire(key, _ttl)
+          .exec();
+      _redis_client->run(
+          [&](auto& redis) { return redis.publish(_channel, session_id); });
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 成员写入失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  bool remove(const std::string& session_id) {
+    try {
+      std::string key = _prefix + session_id;
+      _redis_client->run([&](auto& redis) {
+        redis.del(key);
+        return redis.publish(_channel, session_id);
+      });
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 成员移除失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  const std::string& channel() const { return _channel; }
+
+ private:
+  const std::string _prefix = "members_";
+  const std::string _channel = "members_invalidate";
+  RedisClient::Ptr _redis_client;
+  std::chrono::seconds _ttl;
+};
+
+}  // namespace huzch
\ No newline at end of file
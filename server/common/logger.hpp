@@ -4,42 +4,214 @@
 #include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <string_view>
+#include <type_traits>
+
 namespace huzch {
 
 std::shared_ptr<spdlog::logger> g_default_logger;
+// 错误及以上等级的日志器：异步模式下为同步写出并刷盘的日志器，
+// 错误日志之后常紧跟 abort()，排队中的日志来不及由后台线程写出
+std::shared_ptr<spdlog::logger> g_error_logger;
+// 结构化日志中单个字段的最大字节数，超出部分截断并标注原长度
+size_t g_log_field_max = 512;
+
+struct LoggerOptions {
+  bool async = false;                 // 是否异步写日志
+  size_t queue_size = 8192;           // 异步队列容量(条)
+  std::string overflow = "block";     // 队列满时: block阻塞/overrun覆盖最旧
+  int flush_interval = 3;             // 异步模式下定期刷盘间隔(秒)
+  size_t field_max = 512;             // 结构化日志单个字段最大字节数
+};
 
-void init_logger(bool mode, const std::string& file, int level) {
+void init_logger(bool mode, const std::string& file, int level,
+                 const LoggerOptions& options = LoggerOptions()) {
+  g_log_field_max = options.field_max;
+  spdlog::sink_ptr sink;
   if (mode) {  // 调试模式
-    g_default_logger = spdlog::stdout_color_mt("default_logger");
-    g_default_logger->set_level(spdlog::level::level_enum::trace);
-    g_default_logger->flush_on(spdlog::level::level_enum::trace);
+    sink = std::make_shared<spdlog::sinks::stdout_color_sink_mt>();
+    level = spdlog::level::level_enum::trace;
   } else {  // 发布模式
-    g_default_logger = spdlog::basic_logger_mt("default_logger", file);
-    g_default_logger->set_level((spdlog::level::level_enum)level);
+    sink = std::make_shared<spdlog::sinks::basic_file_sink_mt>(file);
+  }
+
+  if (options.async) {
+    // 日志由后台线程写出，业务线程只做格式化和入队；
+    // 不再逐条刷盘，改为定期刷盘，错误及以上等级仍立即刷盘
+    spdlog::init_thread_pool(options.queue_size, 1);
+    auto policy = options.overflow == "overrun"
+                      ? spdlog::async_overflow_policy::overrun_oldest
+                      : spdlog::async_overflow_policy::block;
+    g_default_logger = std::make_shared<spdlog::async_logger>(
+        "default_logger", sink, spdlog::thread_pool(), policy);
+    spdlog::flush_every(std::chrono::seconds(options.flush_interval));
+    // 与异步日志器共用同一线程安全的输出端，错误日志在调用线程中直接写出
+    g_error_logger = std::make_shared<spdlog::logger>("default_logger", sink);
+    g_error_logger->flush_on(spdlog::level::level_enum::err);
+    g_error_logger->set_level((spdlog::level::level_enum)level);
+    g_error_logger->set_pattern("[%n][%H:%M:%S][%t][%l]%v");
+  } else {
+    g_default_logger = std::make_shared<spdlog::logger>("default_logger", sink);
     g_default_logger->flush_on((spdlog::level::level_enum)level);
+    g_error_logger = g_default_logger;
   }
+  g_default_logger->set_level((spdlog::level::level_enum)level);
+  spdlog::register_logger(g_default_logger);
   // [日志器][时:分:秒][线程][日志等级]日志内容
   g_default_logger->set_pattern("[%n][%H:%M:%S][%t][%l]%v");
 }
 
+// 按等级选择日志器，错误及以上等级同步写出
+inline spdlog::logger* log_target(spdlog::level::level_enum level) {
+  return level >= spdlog::level::level_enum::err ? g_error_logger.get()
+                                                 : g_default_logger.get();
+}
+
+#define LOG_STRINGIFY_(x) #x
+#define LOG_STRINGIFY(x) LOG_STRINGIFY_(x)
+
 // 使用宏包装，在日志前添加代码文件名和行号，便于追踪错误
-#define LOG_TRACE(format, ...)                                        \
-  g_default_logger->trace(std::string("[{}:{}] ") + format, __FILE__, \
-                          __LINE__, ##__VA_ARGS__)
-#define LOG_DEBUG(format, ...)                                        \
-  g_default_logger->debug(std::string("[{}:{}] ") + format, __FILE__, \
-                          __LINE__, ##__VA_ARGS__)
-#define LOG_INFO(format, ...)                                                  \
-  g_default_logger->info(std::string("[{}:{}] ") + format, __FILE__, __LINE__, \
-                         ##__VA_ARGS__)
-#define LOG_WARN(format, ...)                                                  \
-  g_default_logger->warn(std::string("[{}:{}] ") + format, __FILE__, __LINE__, \
-                         ##__VA_ARGS__)
-#define LOG_ERROR(format, ...)                                        \
-  g_default_logger->error(std::string("[{}:{}] ") + format, __FILE__, \
-                          __LINE__, ##__VA_ARGS__)
-#define LOG_CRITICAL(format, ...)                                        \
-  g_default_logger->critical(std::string("[{}:{}] ") + format, __FILE__, \
-                             __LINE__, ##__VA_ARGS__)
+// 前缀与格式串在编译期拼接为一个字面量，等级被过滤时不求值参数、不分配内存
+#define LOG_AT(level, format, ...)                                   \
+  g_default_logger->should_log(level) &&                             \
+      (::huzch::log_target(level)->log(                              \
+           level, "[" __FILE__ ":" LOG_STRINGIFY(__LINE__) "] " format, \
+           ##__VA_ARGS__),                                           \
+       true)
+#define LOG_TRACE(format, ...) \
+  LOG_AT(spdlog::level::level_enum::trace, format, ##__VA_ARGS__)
+#define LOG_DEBUG(format, ...) \
+  LOG_AT(spdlog::level::level_enum::debug, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) \
+  LOG_AT(spdlog::level::level_enum::info, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) \
+  LOG_AT(spdlog::level::level_enum::warn, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) \
+  LOG_AT(spdlog::level::level_enum::err, format, ##__VA_ARGS__)
+#define LOG_CRITICAL(format, ...) \
+  LOG_AT(spdlog::level::level_enum::critical, format, ##__VA_ARGS__)
+
+// 调用点级别的限流与采样
+// 每秒前 per_second 条放行，超出后每 sample 条抽样放行一条(0表示全部丢弃)，
+// 被丢弃的条数累计到下一条放行的日志中输出
+class LogLimiter {
+ public:
+  LogLimiter(size_t per_second, size_t sample = 0)
+      : _per_second(per_second), _sample(sample) {}
+
+  bool allow(size_t& suppressed) {
+    long long now = std::chrono::duration_cast<std::chrono::seconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+    long long window = _window.load(std::memory_order_relaxed);
+    if (window != now &&
+        _window.compare_exchange_strong(window, now,
+                                        std::memory_order_relaxed)) {
+      _count.store(0, std::memory_order_relaxed);
+    }
+
+    size_t count = _count.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (count <= _per_second ||
+        (_sample && (count - _per_second) % _sample == 0)) {
+      suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+      return true;
+    }
+    _suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+ private:
+  size_t _per_second;
+  size_t _sample;
+  std::atomic<long long> _window{0};
+  std::atomic<size_t> _count{0};
+  std::atomic<size_t> _suppressed{0};
+};
+
+namespace detail {
+
+using LogBuffer = fmt::memory_buffer;
+
+// 字符串字段按 g_log_field_max 截断，截断点回退到utf-8字符边界
+inline void append_field(LogBuffer& buf, std::string_view key,
+                         std::string_view value) {
+  if (value.size() <= g_log_field_max) {
+    fmt::format_to(std::back_inserter(buf), " {}={}", key, value);
+    return;
+  }
+  size_t len = g_log_field_max;
+  while (len > 0 && (static_cast<unsigned char>(value[len]) & 0xC0) == 0x80) {
+    --len;
+  }
+  fmt::format_to(std::back_inserter(buf), " {}={}...(共{}字节)", key,
+                 value.substr(0, len), value.size());
+}
+
+template <typename T, typename = std::enable_if_t<
+                          !std::is_convertible_v<const T&, std::string_view>>>
+void append_field(LogBuffer& buf, std::string_view key, const T& value) {
+  fmt::format_to(std::back_inserter(buf), " {}={}", key, value);
+}
+
+inline void append_fields(LogBuffer&) {}
+
+template <typename V, typename... Rest>
+void append_fields(LogBuffer& buf, std::string_view key, const V& value,
+                   const Rest&... rest) {
+  static_assert(sizeof...(Rest) % 2 == 0, "日志字段须为键值对");
+  append_field(buf, key, value);
+  append_fields(buf, rest...);
+}
+
+template <typename... Fields>
+void log_event(spdlog::level::level_enum level, std::string_view location,
+               std::string_view request_id, std::string_view event,
+               size_t suppressed, const Fields&... fields) {
+  LogBuffer buf;
+  if (!request_id.empty()) {
+    fmt::format_to(std::back_inserter(buf), " request_id={}", request_id);
+  }
+  append_fields(buf, fields...);
+  if (suppressed) {
+    fmt::format_to(std::back_inserter(buf), " suppressed={}", suppressed);
+  }
+  log_target(level)->log(level, "{}{}{}", location, event,
+                         std::string_view(buf.data(), buf.size()));
+}
+
+}  // namespace detail
+
+// 结构化日志：[文件:行号] 事件名 request_id=... 键=值 ...
+// lvl 取 trace/debug/info/warn/err/critical，字段为交替的键与值，
+// 字符串值超过 g_log_field_max 时截断；request_id 为空时省略
+#define LOG_EVENT(lvl, request_id, event, ...)                         \
+  do {                                                                   \
+    if (::huzch::g_default_logger->should_log(                           \
+            spdlog::level::level_enum::lvl)) {                         \
+      ::huzch::detail::log_event(                                        \
+          spdlog::level::level_enum::lvl,                              \
+          "[" __FILE__ ":" LOG_STRINGIFY(__LINE__) "] ", request_id,     \
+          event, 0, ##__VA_ARGS__);                                      \
+    }                                                                    \
+  } while (0)
+
+// 限流的结构化日志，每个调用点独立计数，适用于热路径
+#define LOG_EVENT_LIMITED(lvl, per_second, request_id, event, ...)     \
+  do {                                                                   \
+    if (::huzch::g_default_logger->should_log(                           \
+            spdlog::level::level_enum::lvl)) {                         \
+      static ::huzch::LogLimiter log_limiter_(per_second, 100);          \
+      size_t log_suppressed_ = 0;                                        \
+      if (log_limiter_.allow(log_suppressed_)) {                         \
+        ::huzch::detail::log_event(                                      \
+            spdlog::level::level_enum::lvl,                            \
+            "[" __FILE__ ":" LOG_STRINGIFY(__LINE__) "] ", request_id,   \
+            event, log_suppressed_, ##__VA_ARGS__);                      \
+      }                                                                  \
+    }                                                                    \
+  } while (0)
 
 }
\ No newline at end of file
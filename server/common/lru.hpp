@@ -0,0 +1,69 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace huzch {
+
+// 线程安全的定长LRU缓存，超出容量时淘汰最久未访问的条目
+template <typename K, typename V>
+class LRUCache {
+ public:
+  using Ptr = std::shared_ptr<LRUCache>;
+
+ public:
+  LRUCache(size_t capacity) : _capacity(capacity) {}
+
+  bool get(const K& key, V& value) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+      return false;
+    }
+    _entries.splice(_entries.begin(), _entries, it->second);
+    value = it->second->second;
+    return true;
+  }
+
+  void put(const K& key, const V& value) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _index.find(key);
+    if (it != _index.end()) {
+      it->second->second = value;
+      _entries.splice(_entries.begin(), _entries, it->second);
+      return;
+    }
+
+    _entries.emplace_front(key, value);
+    _index[key] = _entries.begin();
+    if (_entries.size() > _capacity) {
+      _index.erase(_entries.back().first);
+      _entries.pop_back();
+    }
+  }
+
+  void remove(const K& key) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _index.find(key);
+    if (it == _index.end()) {
+      return;
+    }
+    _entries.erase(it->second);
+    _index.erase(it);
+  }
+
+  void clear() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _entries.clear();
+    _index.clear();
+  }
+
+ private:
+  size_t _capacity;
+  std::mutex _mutex;
+  std::list<std::pair<K, V>> _entries;
+  std::unordered_map<K, typename std::list<std::pair<K, V>>::iterator> _index;
+};
+
+}  // namespace huzch
\ No newline at end of file
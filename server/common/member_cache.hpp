@@ -0,0 +1,73 @@
+#pragma once
+#include "data_mysql_session_member.hpp"
+#include "data_redis_members.hpp"
+#include "lru.hpp"
+
+namespace huzch {
+
+// 会话成员缓存：本地LRU -> redis集合 -> mysql
+// 好友服务在成员变更时直接写入redis集合并广播失效通知，
+// 因此热路径上只有首次访问历史会话时才会回源mysql
+class MemberCache {
+ public:
+  using Ptr = std::shared_ptr<MemberCache>;
+  using MembersPtr = std::shared_ptr<const std::vector<std::string>>;
+
+ public:
+  MemberCache(const ShardedDatabase::Ptr& mysql_client,
+              const RedisClient::Ptr& redis_client,
+              size_t capacity)
+      : _mysql_session_member(
+            std::make_shared<SessionMemberTable>(mysql_client)),
+        _redis_members(std::make_shared<Members>(redis_client)),
+        _local(capacity),
+        _subscriber(
+            redis_client, _redis_members->channel(),
+            [this](const std::string& session_id) {
+              _local.remove(session_id);
+            },
+            [this]() { _local.clear(); }) {}
+
+  // 获取会话成员id，失败时返回空指针
+  MembersPtr members(const std::string& session_id) {
+    MembersPtr users_id;
+    if (_local.get(session_id, users_id)) {
+      return users_id;
+    }
+
+    std::vector<std::string> cached;
+    if (_redis_members->get(session_id, cached)) {
+      users_id = std::make_shared<const std::vector<std::string>>(
+          std::move(cached));
+      _local.put(session_id, users_id);
+      return users_id;
+    }
+
+    // 回源mysql主库并回填redis，从库的复制延迟会使旧成员写入缓存；
+    // 仅当回源恰好与该会话的成员变更交错时才可能回填旧成员，
+    // 会话成员极少变更且redis集合会过期，这里不做额外的并发控制
+    auto members = _mysql_session_member->members(session_id, true);
+    if (members.empty()) {
+      LOG_ERROR("会话 {} 成员不存在", session_id);
+      return nullptr;
+    }
+    std::vector<std::string> loaded;
+    loaded.reserve(members.size());
+    for (const auto& member : members) {
+      loaded.push_back(member.user_id());
+    }
+    _redis_members->insert(session_id, loaded);
+    users_id =
+        std::make_shared<const std::vector<std::string>>(std::move(loaded));
+    _local.put(session_id, users_id);
+    return users_id;
+  }
+
+ private:
+  SessionMemberTable::Ptr _mysql_session_member;
+  Members::Ptr _redis_members;
+  LRUCache<std::string, MembersPtr> _local;
+  RedisSubscriber _subscriber;
+};
+
+}  // namespace huzch
\ No newline at end of file
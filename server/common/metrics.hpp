@@ -0,0 +1,137 @@
+#pragma once
+#include <brpc/builtin/prometheus_metrics_service.h>
+#include <bvar/bvar.h>
+
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "trace.hpp"
+
+namespace huzch {
+
+// 将服务名、路径等转换为合法的指标名，非字母数字字符替换为下划线
+inline std::string metric_name(const std::string& name) {
+  std::string result;
+  result.reserve(name.size());
+  for (char c : name) {
+    bool alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                 (c >= '0' && c <= '9');
+    if (alnum) {
+      result.push_back(c);
+    } else if (!result.empty() && result.back() != '_') {
+      result.push_back('_');
+    }
+  }
+  while (!result.empty() && result.back() == '_') {
+    result.pop_back();
+  }
+  return result;
+}
+
+// 一类外部调用的耗时与失败数
+// 暴露为 <name>_latency(含分位数)、<name>_qps、<name>_count、<name>_error
+class CallMetric {
+ public:
+  CallMetric(const std::string& name)
+      : _name(name), _latency(name), _error(name + "_error") {}
+
+  const std::string& name() const { return _name; }
+
+  void record(int64_t latency_us, bool ok) {
+    _latency << latency_us;
+    if (!ok) {
+      _error << 1;
+    }
+  }
+
+ private:
+  std::string _name;
+  bvar::LatencyRecorder _latency;
+  bvar::Adder<int64_t> _error;
+};
+
+// 数量分布，如一次推送的扇出人数
+// 暴露为 <name>(平均值)与 <name>_max(最近60秒最大值)
+class SizeMetric {
+ public:
+  SizeMetric(const std::string& name)
+      : _avg(name), _max_window(name + "_max", &_max, 60) {}
+
+  void record(int64_t size) {
+    _avg << size;
+    _max << size;
+  }
+
+ private:
+  bvar::IntRecorder _avg;
+  bvar::Maxer<int64_t> _max;
+  bvar::Window<bvar::Maxer<int64_t>> _max_window;
+};
+
+// 指标注册表，同名指标只创建一次并常驻，调用方应缓存返回的引用
+class Metrics {
+ public:
+  static CallMetric& call(const std::string& name) {
+    return get<CallMetric>(name);
+  }
+
+  static SizeMetric& size(const std::string& name) {
+    return get<SizeMetric>(name);
+  }
+
+  // 以 Prometheus 文本格式导出全部 bvar，包括 brpc 内置指标
+  static std::string prometheus() {
+    butil::IOBuf buf;
+    brpc::DumpPrometheusMetricsToIOBuf(&buf);
+    return buf.to_string();
+  }
+
+ private:
+  template <typename T>
+  static T& get(const std::string& name) {
+    static std::mutex mutex;
+    static std::unordered_map<std::string, std::unique_ptr<T>> metrics;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& metric = metrics[name];
+    if (!metric) {
+      metric = std::make_unique<T>(name);
+    }
+    return *metric;
+  }
+};
+
+// 作用域计时，析构时记录耗时；调用 fail() 或因异常退出作用域时计为失败
+// 处于请求上下文中时同时记录一个以指标名命名的子 span
+class ScopedCall {
+ public:
+  ScopedCall(CallMetric& metric)
+      : _metric(metric),
+        _span(metric.name()),
+        _exceptions(std::uncaught_exceptions()) {
+    _timer.start();
+  }
+
+  ~ScopedCall() {
+    _timer.stop();
+    bool ok = !_failed && std::uncaught_exceptions() == _exceptions;
+    _metric.record(_timer.u_elapsed(), ok);
+    if (!ok) {
+      _span.fail();
+    }
+  }
+
+  void fail() { _failed = true; }
+
+ private:
+  CallMetric& _metric;
+  Span _span;
+  int _exceptions;
+  bool _failed = false;
+  butil::Timer _timer;
+};
+
+}  // namespace huzch
\ No newline at end of file
@@ -2,16 +2,36 @@
 #include <amqpcpp.h>
 #include <amqpcpp/libev.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
 #include <thread>
+#include <vector>
 
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 
 namespace huzch {
 
+// 交换机-队列绑定
+struct MQBinding {
+  std::string exchange;
+  std::string queue;
+  std::string routing_key;
+};
+
 class MQClient {
  public:
   using Ptr = std::shared_ptr<MQClient>;
   using MessageCallBack = std::function<void(const char*, uint64_t)>;
+  // 发布结果回调，参数为broker是否确认收到消息，在事件循环线程中执行
+  using PublishCallBack = std::function<void(bool)>;
 
  public:
   MQClient(const std::string& user, const std::string& passwd,
@@ -23,21 +43,145 @@ class MQClient {
     AMQP::Address addr(url);
     _connection = std::make_unique<AMQP::TcpConnection>(_handler.get(), addr);
     _channel = std::make_unique<AMQP::TcpChannel>(_connection.get());
+    _channel->onError([this](const char* err) {
+      LOG_ERROR("信道异常: {}", err);
+      fail_pending();
+    });
+
+    // 开启发布确认，broker按投递序号回复ack/nack，multiple表示确认此前所有序号
+    _channel->confirmSelect()
+        .onAck([this](uint64_t tag, bool multiple) {
+          complete(tag, multiple, true);
+        })
+        .onNack([this](uint64_t tag, bool multiple, bool) {
+          complete(tag, multiple, false);
+        })
+        .onError([](const char* err) {
+          LOG_ERROR("发布确认开启失败: {}", err);
+          exit(0);
+        });
+
+    // AMQP-CPP 信道只能在事件循环线程中使用，其他线程的操作经任务队列转交
+    ev_async_init(&_async, async_cb);
+    _async.data = this;
+    ev_async_start(_loop, &_async);
 
     _loop_thread = std::thread([this]() { ev_run(_loop); });
   }
 
   ~MQClient() {
-    ev_async watcher;
-    ev_async_init(&watcher, watcher_cb);
-    ev_async_start(_loop, &watcher);
-    ev_async_send(_loop, &watcher);
+    // 先停止消费工作线程，其尚未交回的确认由事件循环在退出前处理
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (auto& consumer : _consumers) {
+        consumer->stop();
+      }
+    }
+    _stop = true;
+    ev_async_send(_loop, &_async);
     _loop_thread.join();
   }
 
   void declare(const std::string& exchange, const std::string& queue,
                const std::string& routing_key = "routing_key",
                AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct) {
+    post([=]() { do_declare(exchange, queue, routing_key, exchange_type); });
+  }
+
+  void declare(const MQBinding& binding,
+               AMQP::ExchangeType exchange_type = AMQP::ExchangeType::direct) {
+    declare(binding.exchange, binding.queue, binding.routing_key,
+            exchange_type);
+  }
+
+  // 异步发布，broker确认后回调；消息在事件循环的同一轮迭代中批量写出
+  // lane_key 随消息头下发，消费端据此将同一键的消息交给同一工作线程顺序处理
+  void publish(const std::string& exchange, const std::string& msg,
+               const PublishCallBack& cb,
+               const std::string& routing_key = "routing_key",
+               const std::string& lane_key = "") {
+    // 耗时从提交发布到broker确认，计入 mq_publish 指标；
+    // 处于请求上下文中时记录发布 span，并经消息头将其传给消费端
+    static auto& metric = Metrics::call("mq_publish");
+    butil::Timer timer;
+    timer.start();
+    std::shared_ptr<Span> span;
+    std::string trace;
+    std::string request_id = RequestContext::request_id();
+    Span* parent = Span::current();
+    if (parent && parent->enabled()) {
+      span = std::make_shared<Span>("mq_publish " + exchange, parent);
+      trace = trace_context(*span);
+    }
+    post([=]() mutable {
+      AMQP::Envelope envelope(msg.data(), msg.size());
+      if (!lane_key.empty() || !trace.empty() || !request_id.empty()) {
+        AMQP::Table headers;
+        if (!lane_key.empty()) {
+          headers.set(_lane_header, lane_key);
+        }
+        if (!trace.empty()) {
+          headers.set(_trace_header, trace);
+        }
+        if (!request_id.empty()) {
+          headers.set(_request_header, request_id);
+        }
+        envelope.setHeaders(headers);
+      }
+      if (!_channel->publish(exchange, routing_key, envelope)) {
+        LOG_ERROR("交换机 {} 消息发布失败", exchange);
+        timer.stop();
+        metric.record(timer.u_elapsed(), false);
+        if (span) {
+          span->fail();
+          span->end();
+        }
+        cb(false);
+        return;
+      }
+      _pending[++_delivery_tag] = [cb, timer, span](bool ret) mutable {
+        timer.stop();
+        metric.record(timer.u_elapsed(), ret);
+        if (span) {
+          if (!ret) {
+            span->fail();
+          }
+          span->end();
+        }
+        cb(ret);
+      };
+    });
+  }
+
+  // 同步发布，阻塞至broker确认，不可在事件循环线程中调用
+  bool publish(const std::string& exchange, const std::string& msg,
+               const std::string& routing_key = "routing_key",
+               const std::string& lane_key = "") {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto future = promise->get_future();
+    publish(
+        exchange, msg, [promise](bool ret) { promise->set_value(ret); },
+        routing_key, lane_key);
+    return future.get();
+  }
+
+  // 每个消费者使用独立信道，prefetch 限制未确认消息数量；
+  // 消息按 lane_key 哈希到 workers 个工作线程，同一键内保持投递顺序
+  void consume(const std::string& queue, const MessageCallBack& cb,
+               uint16_t prefetch = 64, size_t workers = 1,
+               const std::string& tag = "consume_tag") {
+    auto consumer = std::make_shared<Consumer>(this, cb, workers);
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _consumers.push_back(consumer);
+    }
+    post([=]() { consumer->start(_connection.get(), queue, prefetch, tag); });
+  }
+
+ private:
+  void do_declare(const std::string& exchange, const std::string& queue,
+                  const std::string& routing_key,
+                  AMQP::ExchangeType exchange_type) {
     _channel->declareExchange(exchange, exchange_type)
         .onError([](const std::string& err) {
           LOG_ERROR("交换机声明失败: {}", err);
@@ -62,41 +206,210 @@ class MQClient {
         });
   }
 
-  bool publish(const std::string& exchange, const std::string& msg,
-               const std::string& routing_key = "routing_key") {
-    bool ret = _channel->publish(exchange, routing_key, msg);
-    if (!ret) {
-      LOG_ERROR("交换机 {} 消息发布失败", exchange);
-      return false;
+  class Consumer {
+   public:
+    Consumer(MQClient* client, const MessageCallBack& cb, size_t workers)
+        : _client(client), _cb(cb) {
+      for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i) {
+        auto lane = std::make_unique<Lane>();
+        lane->thread = std::thread(&Consumer::run, this, lane.get());
+        _lanes.push_back(std::move(lane));
+      }
     }
-    return true;
-  }
 
-  void consume(const std::string& queue, const MessageCallBack& cb,
-               const std::string& tag = "consume_tag") {
-    _channel->consume(queue, tag)
-        .onReceived(
-            [this, cb](const AMQP::Message& msg, uint64_t deliveryTag, bool) {
-              cb(msg.body(), msg.bodySize());
-              _channel->ack(deliveryTag);
-            })
-        .onError([queue](const std::string& err) {
-          LOG_ERROR("队列 {} 消息订阅失败: {}", queue, err);
-          exit(0);
+    ~Consumer() { stop(); }
+
+    // 以下两个方法在事件循环线程中调用
+    void start(AMQP::TcpConnection* connection, const std::string& queue,
+               uint16_t prefetch, const std::string& tag) {
+      _queue = queue;
+      _channel = std::make_unique<AMQP::TcpChannel>(connection);
+      _channel->setQos(prefetch);
+      _channel->consume(queue, tag)
+          .onReceived([this](const AMQP::Message& msg, uint64_t delivery_tag,
+                             bool) { dispatch(msg, delivery_tag); })
+          .onError([queue](const std::string& err) {
+            LOG_ERROR("队列 {} 消息订阅失败: {}", queue, err);
+            exit(0);
+          });
+    }
+
+    // 投递序号在信道内从1开始连续递增，只确认连续完成的最大序号，
+    // 一轮事件循环中到达的多个完成通知合并为一次 multiple 确认
+    void ack(uint64_t delivery_tag) {
+      _done.insert(delivery_tag);
+      bool advanced = false;
+      while (!_done.empty() && *_done.begin() == _acked + 1) {
+        _done.erase(_done.begin());
+        ++_acked;
+        advanced = true;
+      }
+      if (advanced && !_flush_scheduled) {
+        _flush_scheduled = true;
+        _client->post([this]() {
+          _flush_scheduled = false;
+          _channel->ack(_acked, AMQP::multiple);
         });
+      }
+    }
+
+    void stop() {
+      for (auto& lane : _lanes) {
+        {
+          std::unique_lock<std::mutex> lock(lane->mutex);
+          lane->stop = true;
+        }
+        lane->cond.notify_all();
+      }
+      for (auto& lane : _lanes) {
+        if (lane->thread.joinable()) {
+          lane->thread.join();
+        }
+      }
+    }
+
+   private:
+    struct Delivery {
+      uint64_t tag;
+      std::string body;
+      std::string trace;       // 发布端的追踪上下文
+      std::string request_id;  // 发布端所处请求的 request_id
+    };
+
+    struct Lane {
+      std::mutex mutex;
+      std::condition_variable cond;
+      std::deque<Delivery> deliveries;
+      bool stop = false;
+      std::thread thread;
+    };
+
+    void dispatch(const AMQP::Message& msg, uint64_t delivery_tag) {
+      const std::string& key = msg.headers().get(_lane_header);
+      size_t index = key.empty() ? delivery_tag % _lanes.size()
+                                 : std::hash<std::string>()(key) % _lanes.size();
+      auto& lane = _lanes[index];
+      {
+        std::unique_lock<std::mutex> lock(lane->mutex);
+        lane->deliveries.push_back(
+            {delivery_tag, std::string(msg.body(), msg.bodySize()),
+             msg.headers().get(_trace_header),
+             msg.headers().get(_request_header)});
+      }
+      lane->cond.notify_one();
+    }
+
+    void run(Lane* lane) {
+      while (true) {
+        Delivery delivery;
+        {
+          std::unique_lock<std::mutex> lock(lane->mutex);
+          lane->cond.wait(lock, [lane]() {
+            return lane->stop || !lane->deliveries.empty();
+          });
+          if (lane->stop) {
+            return;
+          }
+          delivery = std::move(lane->deliveries.front());
+          lane->deliveries.pop_front();
+        }
+        {
+          // 消费端根 span 接续发布端的 trace，处理过程中的调用挂在其下
+          std::string trace_id;
+          uint64_t parent_id = 0;
+          parse_trace_context(delivery.trace, trace_id, parent_id);
+          Span span("mq_consume " + _queue, trace_id, parent_id);
+          SpanScope scope(&span);
+          RequestScope request(delivery.request_id, std::string());
+
+          static auto& metric = Metrics::call("mq_consume");
+          ScopedCall call(metric);
+          _cb(delivery.body.data(), delivery.body.size());
+        }
+        uint64_t tag = delivery.tag;
+        _client->post([this, tag]() { ack(tag); });
+      }
+    }
+
+   private:
+    MQClient* _client;
+    MessageCallBack _cb;
+    std::string _queue;
+    std::vector<std::unique_ptr<Lane>> _lanes;
+    std::unique_ptr<AMQP::TcpChannel> _channel;
+    // 以下成员只在事件循环线程中访问
+    uint64_t _acked = 0;
+    std::set<uint64_t> _done;
+    bool _flush_scheduled = false;
+  };
+
+  void post(std::function<void()>&& task) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _tasks.push_back(std::move(task));
+    }
+    ev_async_send(_loop, &_async);
   }
 
- private:
-  static void watcher_cb(struct ev_loop* loop, ev_async*, int) {
-    ev_break(loop, EVBREAK_ALL);
+  // 多次 ev_async_send 可能合并为一次回调，因此每次取出全部任务执行
+  static void async_cb(struct ev_loop* loop, ev_async* watcher, int) {
+    auto client = static_cast<MQClient*>(watcher->data);
+    std::vector<std::function<void()>> tasks;
+    {
+      std::unique_lock<std::mutex> lock(client->_mutex);
+      tasks.swap(client->_tasks);
+    }
+    for (auto& task : tasks) {
+      task();
+    }
+    if (client->_stop) {
+      client->fail_pending();
+      ev_break(loop, EVBREAK_ALL);
+    }
+  }
+
+  void complete(uint64_t tag, bool multiple, bool ack) {
+    auto begin = multiple ? _pending.begin() : _pending.find(tag);
+    auto end = _pending.upper_bound(tag);
+    if (begin == _pending.end()) {
+      return;
+    }
+    for (auto it = begin; it != end; ++it) {
+      if (!ack) {
+        LOG_ERROR("消息 {} 未被broker确认", it->first);
+      }
+      it->second(ack);
+    }
+    _pending.erase(begin, end);
+  }
+
+  void fail_pending() {
+    for (auto& [tag, cb] : _pending) {
+      cb(false);
+    }
+    _pending.clear();
   }
 
  private:
   struct ev_loop* _loop;
+  ev_async _async;
+  std::atomic<bool> _stop{false};
+  std::mutex _mutex;
+  std::vector<std::function<void()>> _tasks;
   std::unique_ptr<AMQP::LibEvHandler> _handler;
   std::unique_ptr<AMQP::TcpConnection> _connection;
   std::unique_ptr<AMQP::TcpChannel> _channel;
   std::thread _loop_thread;
+
+  std::vector<std::shared_ptr<Consumer>> _consumers;
+
+  // 以下成员只在事件循环线程中访问
+  uint64_t _delivery_tag = 0;
+  std::map<uint64_t, PublishCallBack> _pending;
+
+  static constexpr const char* _lane_header = "lane";
+  static constexpr const char* _trace_header = "trace";
+  static constexpr const char* _request_header = "request_id";
 };
 
 }  // namespace huzch
\ No newline at end of file
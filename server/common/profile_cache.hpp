@@ -0,0 +1,118 @@
+#pragma once
+#include "base.pb.h"
+#include "data_redis.hpp"
+#include "lru.hpp"
+
+namespace huzch {
+
+// 用户资料缓存
+// 用户服务修改资料后递增版本号并广播 user_id:version，缓存收到后淘汰旧资料
+// 并记录最新版本；回源得到的资料若版本低于已知最新版本则不回填，
+// 避免回源与修改交错时缓存旧资料。版本号同样缓存在本地，由广播更新，
+// 精简模式与批量资料查询无需每次读redis
+class ProfileCache {
+ public:
+  using Ptr = std::shared_ptr<ProfileCache>;
+  using ProfilePtr = std::shared_ptr<const UserInfo>;
+
+ public:
+  ProfileCache(const RedisClient::Ptr& redis_client,
+               size_t capacity)
+      : _redis_profile(std::make_shared<ProfileVersion>(redis_client)),
+        _profiles(capacity),
+        _versions(capacity),
+        _subscriber(
+            redis_client, _redis_profile->channel(),
+            std::bind(&ProfileCache::on_invalidate, this,
+                      std::placeholders::_1),
+            [this]() {
+              // 断线期间可能漏掉广播，已知版本与资料都不再可信
+              std::unique_lock<std::mutex> lock(_mutex);
+              _profiles.clear();
+              _versions.clear();
+            }) {}
+
+  ProfilePtr get(const std::string& user_id) {
+    ProfilePtr profile;
+    _profiles.get(user_id, profile);
+    return profile;
+  }
+
+  void put(const UserInfo& user_info) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    long long latest = 0;
+    if (_versions.get(user_info.user_id(), latest) &&
+        user_info.profile_version() < latest) {
+      return;
+    }
+    _profiles.put(user_info.user_id(), std::make_shared<UserInfo>(user_info));
+    _versions.put(user_info.user_id(), user_info.profile_version());
+  }
+
+  // 获取资料版本，失败返回-1
+  long long version(const std::string& user_id) {
+    std::unordered_map<std::string, long long> versions;
+    if (!this->versions({user_id}, versions)) {
+      return -1;
+    }
+    return versions[user_id];
+  }
+
+  // 批量获取资料版本：优先取本地记录的版本，未命中的从redis批量读取并记录；
+  // 读取期间收到更新的广播时保留较新的版本
+  bool versions(const std::vector<std::string>& users_id,
+                std::unordered_map<std::string, long long>& versions) {
+    std::vector<std::string> missed;
+    for (const auto& user_id : users_id) {
+      long long version = 0;
+      if (_versions.get(user_id, version)) {
+        versions[user_id] = version;
+      } else {
+        missed.push_back(user_id);
+      }
+    }
+    if (missed.empty()) {
+      return true;
+    }
+
+    std::unordered_map<std::string, long long> loaded;
+    if (!_redis_profile->versions(missed, loaded)) {
+      return false;
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto& [user_id, version] : loaded) {
+      long long latest = 0;
+      if (_versions.get(user_id, latest) && latest > version) {
+        version = latest;
+      } else {
+        _versions.put(user_id, version);
+      }
+      versions[user_id] = version;
+    }
+    return true;
+  }
+
+ private:
+  void on_invalidate(const std::string& message) {
+    size_t pos = message.rfind(':');
+    if (pos == std::string::npos) {
+      LOG_ERROR("用户资料失效通知格式错误: {}", message);
+      return;
+    }
+    std::string user_id = message.substr(0, pos);
+    long long version = std::stoll(message.substr(pos + 1));
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _versions.put(user_id, version);
+    _profiles.remove(user_id);
+  }
+
+ private:
+  ProfileVersion::Ptr _redis_profile;
+  std::mutex _mutex;
+  LRUCache<std::string, ProfilePtr> _profiles;
+  LRUCache<std::string, long long> _versions;
+  RedisSubscriber _subscriber;
+};
+
+}  // namespace huzch
\ No newline at end of file
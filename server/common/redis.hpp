@@ -0,0 +1,253 @@
+#pragma once
+#include <sw/redis++/redis++.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "logger.hpp"
+#include "metrics.hpp"
+
+namespace huzch {
+
+// redis客户端配置
+// mode 为 single 单节点、sentinel 哨兵或 cluster 集群：
+// 单节点与集群模式使用 host:port(集群模式下为任一种子节点)，
+// 哨兵模式使用 sentinels 与 master_name 自动发现并切换主库
+struct RedisOptions {
+  std::string mode = "single";
+  std::string host = "127.0.0.1";
+  int port = 6379;
+  int db = 0;
+  bool keep_alive = true;
+  std::string sentinels;
+  std::string master_name;
+  size_t pool_size = 8;
+  int wait_timeout = 100;     // 从连接池获取连接的等待时间(毫秒)
+  int connect_timeout = 100;  // 建连超时(毫秒)
+  int socket_timeout = 200;   // 读写超时(毫秒)
+  bool read_replica = false;  // 允许容忍复制延迟的读取走从库
+};
+
+// 统一单节点/哨兵与集群两种客户端
+// sw::redis::Redis 与 sw::redis::RedisCluster 接口一致但无公共基类，
+// 通过 run 将操作分派给实际的客户端；pipeline 与事务在集群模式下
+// 只能作用于同一槽位，需给出哈希标签
+// run/read 的耗时与异常分别计入 redis_call、redis_read 指标
+class RedisClient {
+ public:
+  using Ptr = std::shared_ptr<RedisClient>;
+  using RedisPtr = std::shared_ptr<sw::redis::Redis>;
+  using ClusterPtr = std::shared_ptr<sw::redis::RedisCluster>;
+
+ public:
+  RedisClient(const RedisPtr& redis, const RedisPtr& replica = nullptr)
+      : _redis(redis),
+        _redis_replica(replica),
+        _call_metric(Metrics::call("redis_call")),
+        _read_metric(Metrics::call("redis_read")) {}
+
+  RedisClient(const ClusterPtr& cluster, const ClusterPtr& replica = nullptr)
+      : _cluster(cluster),
+        _cluster_replica(replica),
+        _call_metric(Metrics::call("redis_call")),
+        _read_metric(Metrics::call("redis_read")) {}
+
+  bool cluster() const { return _cluster != nullptr; }
+
+  bool has_replica() const { return _redis_replica || _cluster_replica; }
+
+  template <typename F>
+  decltype(auto) run(F&& fn) {
+    ScopedCall call(_call_metric);
+    if (_cluster) {
+      return fn(*_cluster);
+    }
+    return fn(*_redis);
+  }
+
+  // 读从库，未配置从库时读主库；调用方需容忍复制延迟
+  template <typename F>
+  decltype(auto) read(F&& fn) {
+    ScopedCall call(_read_metric);
+    if (_cluster) {
+      return fn(_cluster_replica ? *_cluster_replica : *_cluster);
+    }
+    return fn(_redis_replica ? *_redis_replica : *_redis);
+  }
+
+  sw::redis::Pipeline pipeline(const std::string& hash_tag) {
+    if (_cluster) {
+      return _cluster->pipeline(hash_tag, false);
+    }
+    return _redis->pipeline(false);
+  }
+
+  sw::redis::Transaction transaction(const std::string& hash_tag) {
+    if (_cluster) {
+      return _cluster->transaction(hash_tag, false, false);
+    }
+    return _redis->transaction(false, false);
+  }
+
+  sw::redis::Subscriber subscriber() {
+    if (_cluster) {
+      return _cluster->subscriber();
+    }
+    return _redis->subscriber();
+  }
+
+ private:
+  RedisPtr _redis;
+  RedisPtr _redis_replica;
+  ClusterPtr _cluster;
+  ClusterPtr _cluster_replica;
+  CallMetric& _call_metric;
+  CallMetric& _read_metric;
+};
+
+class RedisClientFactory {
+ public:
+  static RedisClient::Ptr create(const RedisOptions& options) {
+    sw::redis::ConnectionOptions conn_opts;
+    conn_opts.host = options.host;
+    conn_opts.port = options.port;
+    conn_opts.db = options.db;
+    conn_opts.keep_alive = options.keep_alive;
+    conn_opts.connect_timeout =
+        std::chrono::milliseconds(options.connect_timeout);
+    conn_opts.socket_timeout = std::chrono::milliseconds(options.socket_timeout);
+
+    sw::redis::ConnectionPoolOptions pool_opts;
+    pool_opts.size = options.pool_size;
+    pool_opts.wait_timeout = std::chrono::milliseconds(options.wait_timeout);
+
+    if (options.mode == "cluster") {
+      auto cluster =
+          std::make_shared<sw::redis::RedisCluster>(conn_opts, pool_opts);
+      RedisClient::ClusterPtr replica;
+      if (options.read_replica) {
+        replica = std::make_shared<sw::redis::RedisCluster>(
+            conn_opts, pool_opts, sw::redis::Role::SLAVE);
+      }
+      return std::make_shared<RedisClient>(cluster, replica);
+    }
+
+    if (options.mode == "sentinel") {
+      sw::redis::SentinelOptions sentinel_opts;
+      sentinel_opts.nodes = parse(options.sentinels);
+      sentinel_opts.connect_timeout = conn_opts.connect_timeout;
+      sentinel_opts.socket_timeout = conn_opts.socket_timeout;
+      auto sentinel = std::make_shared<sw::redis::Sentinel>(sentinel_opts);
+      auto redis = std::make_shared<sw::redis::Redis>(
+          sentinel, options.master_name, sw::redis::Role::MASTER, conn_opts,
+          pool_opts);
+      RedisClient::RedisPtr replica;
+      if (options.read_replica) {
+        replica = std::make_shared<sw::redis::Redis>(
+            sentinel, options.master_name, sw::redis::Role::SLAVE, conn_opts,
+            pool_opts);
+      }
+      return std::make_shared<RedisClient>(redis, replica);
+    }
+
+    if (options.mode != "single") {
+      LOG_ERROR("未知的redis部署模式 {}，按单节点处理", options.mode);
+    }
+    return std::make_shared<RedisClient>(
+        std::make_shared<sw::redis::Redis>(conn_opts, pool_opts));
+  }
+
+ private:
+  // 解析逗号分隔的 host:port 列表
+  static std::vector<std::pair<std::string, int>> parse(
+      const std::string& hosts) {
+    std::vector<std::pair<std::string, int>> result;
+    std::stringstream ss(hosts);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      size_t pos = item.rfind(':');
+      if (pos == std::string::npos) {
+        result.emplace_back(item, 26379);
+      } else {
+        result.emplace_back(item.substr(0, pos),
+                            std::stoi(item.substr(pos + 1)));
+      }
+    }
+    return result;
+  }
+};
+
+// 频道订阅：后台线程持续消费频道消息，连接异常时自动重新订阅
+// 订阅断开期间可能错过消息，重新订阅成功后回调 on_resubscribe
+class RedisSubscriber {
+ public:
+  using Ptr = std::shared_ptr<RedisSubscriber>;
+  using MessageCallback = std::function<void(const std::string&)>;
+  using ResubscribeCallback = std::function<void()>;
+
+ public:
+  RedisSubscriber(const RedisClient::Ptr& redis_client,
+                  const std::string& channel, const MessageCallback& on_message,
+                  const ResubscribeCallback& on_resubscribe)
+      : _redis_client(redis_client),
+        _channel(channel),
+        _on_message(on_message),
+        _on_resubscribe(on_resubscribe),
+        _thread(&RedisSubscriber::run, this) {}
+
+  ~RedisSubscriber() {
+    _stop = true;
+    // 向频道发送一条空消息，唤醒阻塞在 consume 上的订阅线程
+    try {
+      _redis_client->run(
+          [this](auto& redis) { return redis.publish(_channel, ""); });
+      _thread.join();
+    } catch (const std::exception& e) {
+      LOG_ERROR("频道 {} 订阅线程唤醒失败: {}", _channel, e.what());
+      _thread.detach();
+    }
+  }
+
+ private:
+  void run() {
+    while (!_stop) {
+      try {
+        auto subscriber = _redis_client->subscriber();
+        subscriber.on_message(
+            [this](const std::string& channel, const std::string& message) {
+              if (!message.empty()) {
+                _on_message(message);
+              }
+            });
+        subscriber.subscribe(_channel);
+        _on_resubscribe();
+        while (!_stop) {
+          // 订阅连接沿用 socket_timeout，频道空闲时 consume 超时属正常情况，
+          // 订阅仍然有效，继续消费即可，不能当作连接异常重新订阅
+          try {
+            subscriber.consume();
+          } catch (const sw::redis::TimeoutError&) {
+            continue;
+          }
+        }
+      } catch (const std::exception& e) {
+        LOG_ERROR("频道 {} 订阅异常: {}", _channel, e.what());
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+      }
+    }
+  }
+
+ private:
+  RedisClient::Ptr _redis_client;
+  std::string _channel;
+  MessageCallback _on_message;
+  ResubscribeCallback _on_resubscribe;
+  std::atomic<bool> _stop{false};
+  std::thread _thread;
+};
+
+}  // namespace huzch
\ No newline at end of file
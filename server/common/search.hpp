@@ -6,6 +6,8 @@
 #include <sstream>
 
 #include "logger.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 namespace huzch {
@@ -96,11 +98,15 @@ class ESInsert {
       LOG_ERROR("索引序列化失败");
       return false;
     }
-    LOG_DEBUG("{}", body);
+    LOG_EVENT_LIMITED(debug, 10, RequestContext::request_id(), "es_insert",
+                      "index", _name, "id", id, "body", body);
 
     try {
+      static auto& metric = Metrics::call("es_insert");
+      ScopedCall call(metric);
       auto resp = _client->index(_name, _type, id, body);
       if (resp.status_code < 200 || resp.status_code >= 300) {
+        call.fail();
         LOG_ERROR("索引 {} 插入失败，状态码: {}", _name, resp.status_code);
         return false;
       }
@@ -126,8 +132,11 @@ class ESRemove {
 
   bool remove(const std::string& id) {
     try {
+      static auto& metric = Metrics::call("es_remove");
+      ScopedCall call(metric);
       auto resp = _client->remove(_name, _type, id);
       if (resp.status_code < 200 || resp.status_code >= 300) {
+        call.fail();
         LOG_ERROR("索引 {} 删除失败，状态码: {}", _name, resp.status_code);
         return false;
       }
@@ -217,12 +226,16 @@ class ESSearch {
       LOG_ERROR("索引序列化失败");
       return false;
     }
-    LOG_DEBUG("{}", body);
+    LOG_EVENT_LIMITED(debug, 10, RequestContext::request_id(), "es_search",
+                      "index", _name, "body", body);
 
     cpr::Response resp;
     try {
+      static auto& metric = Metrics::call("es_search");
+      ScopedCall call(metric);
       resp = _client->search(_name, _type, body);
       if (resp.status_code < 200 || resp.status_code >= 300) {
+        call.fail();
         LOG_ERROR("索引 {} 搜索失败，状态码: {}", _name, resp.status_code);
         return Json::Value();
       }
@@ -231,7 +244,9 @@ class ESSearch {
       return Json::Value();
     }
 
-    LOG_DEBUG("{}", resp.text);
+    LOG_EVENT_LIMITED(debug, 10, RequestContext::request_id(),
+                      "es_search_resp", "index", _name, "bytes",
+                      resp.text.size(), "resp", resp.text);
     Json::Value resp_json;
     ret = unserialize(resp.text, resp_json);
     if (!ret) {
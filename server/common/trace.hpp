@@ -0,0 +1,365 @@
+#pragma once
+#include <brpc/callback.h>
+#include <brpc/controller.h>
+#include <bthread/bthread.h>
+#include <google/protobuf/service.h>
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "logger.hpp"
+#include "utils.hpp"
+
+namespace huzch {
+
+// 轻量链路追踪
+// 以请求的 request_id 作为 trace id；跨进程时上游 span id 经 brpc 的 log_id
+// 或 AMQP 消息头传递。一次请求在本进程内的 span 先缓存在 Trace 中，
+// 根 span 结束时以 JSON 行一次性写入追踪文件，由采集端按 trace id 汇总
+struct SpanRecord {
+  uint64_t span_id;
+  uint64_t parent_id;
+  std::string name;
+  int64_t start_us;     // 开始时间(墙上时钟，便于跨机器对齐)
+  int64_t duration_us;  // 耗时(单调时钟)
+  bool ok;
+};
+
+class Tracer {
+ public:
+  // 追踪文件为空时不开启追踪，所有 span 退化为空操作
+  static void init(const std::string& service, const std::string& file) {
+    if (file.empty()) {
+      return;
+    }
+    service_name() = service;
+    sink() = spdlog::create_async<spdlog::sinks::basic_file_sink_mt>(
+        "trace", file);
+    sink()->set_pattern("%v");
+    sink()->flush_on(spdlog::level::level_enum::err);
+  }
+
+  static bool enabled() { return sink() != nullptr; }
+
+  static void write(const std::string& trace_id,
+                    const std::vector<SpanRecord>& records) {
+    for (const auto& record : records) {
+      sink()->info(
+          "{{\"trace_id\":\"{}\",\"span_id\":\"{:016x}\","
+          "\"parent_id\":\"{:016x}\",\"service\":\"{}\",\"name\":\"{}\","
+          "\"start_us\":{},\"duration_us\":{},\"ok\":{}}}",
+          trace_id, record.span_id, record.parent_id, service_name(),
+          record.name, record.start_us, record.duration_us, record.ok);
+    }
+  }
+
+ private:
+  static std::shared_ptr<spdlog::logger>& sink() {
+    static std::shared_ptr<spdlog::logger> logger;
+    return logger;
+  }
+
+  static std::string& service_name() {
+    static std::string name;
+    return name;
+  }
+};
+
+// 一次请求在本进程内的追踪数据，由同一请求的所有 span 共享
+class Trace {
+ public:
+  using Ptr = std::shared_ptr<Trace>;
+
+ public:
+  Trace(const std::string& id) : _id(id) {}
+
+  const std::string& id() const { return _id; }
+
+  void add(SpanRecord&& record) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_flushed) {
+      // 根 span 结束后才完成的异步调用直接写出
+      Tracer::write(_id, {record});
+      return;
+    }
+    _records.push_back(std::move(record));
+  }
+
+  void flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    Tracer::write(_id, _records);
+    _records.clear();
+    _flushed = true;
+  }
+
+ private:
+  std::string _id;
+  std::mutex _mutex;
+  std::vector<SpanRecord> _records;
+  bool _flushed = false;
+};
+
+// span 在析构或 end() 时记录；未开启追踪或没有所属请求时不记录
+// 当前 span 保存在 bthread 局部存储中，在 pthread 中同样可用
+class Span {
+ public:
+  // 根 span：trace_id 为请求的 request_id，parent_id 为上游 span id(无则为0)
+  Span(const std::string& name, const std::string& trace_id,
+       uint64_t parent_id) {
+    if (!Tracer::enabled()) {
+      return;
+    }
+    _trace = std::make_shared<Trace>(trace_id.empty() ? uuid() : trace_id);
+    _root = true;
+    start(name, parent_id);
+  }
+
+  // 子 span：挂在 parent 下，parent 为空时不记录
+  Span(const std::string& name, Span* parent) {
+    if (!parent || !parent->_trace) {
+      return;
+    }
+    _trace = parent->_trace;
+    start(name, parent->_record.span_id);
+  }
+
+  // 挂在当前 span 下的子 span
+  explicit Span(const std::string& name) : Span(name, current()) {}
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  ~Span() { end(); }
+
+  bool enabled() const { return _trace != nullptr; }
+  uint64_t id() const { return _trace ? _record.span_id : 0; }
+  const std::string& trace_id() const { return _trace->id(); }
+
+  void fail() { _record.ok = false; }
+
+  void end() {
+    if (!_trace || _ended) {
+      return;
+    }
+    _ended = true;
+    _record.duration_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - _start)
+            .count();
+    _trace->add(std::move(_record));
+    if (_root) {
+      _trace->flush();
+    }
+  }
+
+  static Span* current() {
+    return static_cast<Span*>(bthread_getspecific(key()));
+  }
+
+  static void set_current(Span* span) { bthread_setspecific(key(), span); }
+
+ private:
+  void start(const std::string& name, uint64_t parent_id) {
+    _start = std::chrono::steady_clock::now();
+    _record.span_id = random64();
+    _record.parent_id = parent_id;
+    _record.name = name;
+    _record.start_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+    _record.ok = true;
+  }
+
+  static bthread_key_t key() {
+    static bthread_key_t key = []() {
+      bthread_key_t key;
+      bthread_key_create(&key, nullptr);
+      return key;
+    }();
+    return key;
+  }
+
+ private:
+  Trace::Ptr _trace;
+  SpanRecord _record;
+  std::chrono::steady_clock::time_point _start;
+  bool _root = false;
+  bool _ended = false;
+};
+
+// 在作用域内将 span 设为当前 span，之后创建的子 span 挂在其下
+class SpanScope {
+ public:
+  SpanScope(Span* span) : _prev(Span::current()) { Span::set_current(span); }
+  ~SpanScope() { Span::set_current(_prev); }
+
+ private:
+  Span* _prev;
+};
+
+// 跨进程传递的上下文 "trace_id:span_id"，用于 AMQP 消息头
+inline std::string trace_context(const Span& span) {
+  if (!span.enabled()) {
+    return std::string();
+  }
+  return fmt::format("{}:{:016x}", span.trace_id(), span.id());
+}
+
+inline bool parse_trace_context(const std::string& context,
+                                std::string& trace_id, uint64_t& span_id) {
+  size_t pos = context.rfind(':');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  trace_id = context.substr(0, pos);
+  span_id = std::strtoull(context.c_str() + pos + 1, nullptr, 16);
+  return true;
+}
+
+// 读取请求消息的字符串字段，没有该字段时返回空串
+inline std::string string_field_of(const google::protobuf::Message& message,
+                                   const std::string& name) {
+  auto field = message.GetDescriptor()->FindFieldByName(name);
+  if (!field ||
+      field->type() != google::protobuf::FieldDescriptor::TYPE_STRING) {
+    return std::string();
+  }
+  return message.GetReflection()->GetString(message, field);
+}
+
+inline std::string request_id_of(const google::protobuf::Message& message) {
+  return string_field_of(message, "request_id");
+}
+
+// 当前请求的上下文：请求消息的 request_id 与发起用户 user_id 字段，
+// 不在请求上下文中时均为空；与当前 span 一样保存在 bthread 局部存储中，
+// 不开启追踪时同样可用，供日志关联、读己之写等按请求或用户的判断使用
+class RequestContext {
+ public:
+  static const std::string& request_id() {
+    auto context = current();
+    return context ? context->_request_id : empty();
+  }
+
+  static const std::string& user_id() {
+    auto context = current();
+    return context ? context->_user_id : empty();
+  }
+
+ private:
+  friend class RequestScope;
+
+  RequestContext(const std::string& request_id, const std::string& user_id)
+      : _request_id(request_id), _user_id(user_id) {}
+
+  static const RequestContext* current() {
+    return static_cast<const RequestContext*>(bthread_getspecific(key()));
+  }
+
+  static const std::string& empty() {
+    static const std::string empty;
+    return empty;
+  }
+
+  static bthread_key_t key() {
+    static bthread_key_t key = []() {
+      bthread_key_t key;
+      bthread_key_create(&key, nullptr);
+      return key;
+    }();
+    return key;
+  }
+
+ private:
+  std::string _request_id;
+  std::string _user_id;
+};
+
+// 在作用域内设置当前请求的上下文
+class RequestScope {
+ public:
+  RequestScope(const std::string& request_id, const std::string& user_id)
+      : _context(request_id, user_id),
+        _prev(bthread_getspecific(RequestContext::key())) {
+    bthread_setspecific(RequestContext::key(), &_context);
+  }
+  ~RequestScope() { bthread_setspecific(RequestContext::key(), _prev); }
+
+ private:
+  RequestContext _context;
+  void* _prev;
+};
+
+// 内部发起的调用沿用当前请求的 trace id，未开启追踪时沿用当前请求的
+// request_id，不在请求上下文中时生成新的id
+inline std::string trace_request_id() {
+  Span* span = Span::current();
+  if (span && span->enabled()) {
+    return span->trace_id();
+  }
+  const std::string& request_id = RequestContext::request_id();
+  return request_id.empty() ? uuid() : request_id;
+}
+
+// 服务端追踪：包装 rpc 服务，为每次调用建立根 span
+// trace id 取请求的 request_id，上游 span id 取 brpc 请求元数据中的 log_id；
+// 同时在调用期间记录请求上下文，服务处理函数均同步执行
+class TracedService : public google::protobuf::Service {
+ public:
+  TracedService(google::protobuf::Service* service) : _service(service) {}
+
+  const google::protobuf::ServiceDescriptor* GetDescriptor() override {
+    return _service->GetDescriptor();
+  }
+
+  const google::protobuf::Message& GetRequestPrototype(
+      const google::protobuf::MethodDescriptor* method) const override {
+    return _service->GetRequestPrototype(method);
+  }
+
+  const google::protobuf::Message& GetResponsePrototype(
+      const google::protobuf::MethodDescriptor* method) const override {
+    return _service->GetResponsePrototype(method);
+  }
+
+  void CallMethod(const google::protobuf::MethodDescriptor* method,
+                  google::protobuf::RpcController* controller,
+                  const google::protobuf::Message* request,
+                  google::protobuf::Message* response,
+                  google::protobuf::Closure* done) override {
+    std::string request_id = request_id_of(*request);
+    RequestScope request_scope(request_id, string_field_of(*request, "user_id"));
+    if (!Tracer::enabled()) {
+      _service->CallMethod(method, controller, request, response, done);
+      return;
+    }
+
+    auto ctrl = static_cast<brpc::Controller*>(controller);
+    auto span =
+        new Span(method->full_name(), request_id, ctrl->log_id());
+    SpanScope scope(span);
+    _service->CallMethod(
+        method, controller, request, response,
+        brpc::NewCallback(&TracedService::on_done, span, ctrl, done));
+  }
+
+ private:
+  static void on_done(Span* span, brpc::Controller* ctrl,
+                      google::protobuf::Closure* done) {
+    if (ctrl->Failed()) {
+      span->fail();
+    }
+    delete span;
+    done->Run();
+  }
+
+ private:
+  std::unique_ptr<google::protobuf::Service> _service;
+};
+
+}  // namespace huzch
\ No newline at end of file
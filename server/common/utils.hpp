@@ -1,50 +1,105 @@
 #pragma once
 #include <cpr/cpr.h>
 #include <json/json.h>
+#include <sys/random.h>
 
+#include <cerrno>
+#include <chrono>
 #include <fstream>
-#include <iomanip>
 #include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "logger.hpp"
 
 namespace huzch {
 
-// 随机生成16位16进制字符
-std::string uuid() {
-  // 生成12位16进制字符 --- 6字节
-  std::random_device rd;         // 设备随机数，真随机但效率低，作为种子
-  std::mt19937 generator(rd());  // 生成伪随机数
-  std::uniform_int_distribution<int> distribution(0, 255);  // 限定随机数范围
+// 线程局部的 splitmix64 伪随机数，种子只在线程首次调用时取一次设备随机数
+// 输出可由少量样本反推，只用于消息id、请求id等非机密场景，
+// 登录会话、验证码等须使用 secure_random
+uint64_t random64() {
+  thread_local uint64_t state = []() {
+    std::random_device rd;
+    uint64_t seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+    return seed ^ std::hash<std::thread::id>()(std::this_thread::get_id());
+  }();
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
 
-  std::stringstream ss;
-  for (size_t i = 0; i < 6; ++i) {
-    ss << std::setw(2) << std::setfill('0') << std::hex
-       << distribution(generator);
+constexpr size_t UUID_LEN = 24;
+
+// 生成24位16进制字符到 buf，不分配内存
+// 前12位为毫秒时间戳，后12位为随机数：id 大致按时间递增，
+// 作为索引插入时集中在B+树尾部；同一毫秒内48位随机数保证不重复
+void uuid(char* buf) {
+  static const char digits[] = "0123456789abcdef";
+  uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+  uint64_t rnd = random64();
+  for (size_t i = UUID_LEN / 2; i > 0; --i) {
+    buf[i - 1] = digits[ms & 0xf];
+    ms >>= 4;
   }
+  for (size_t i = UUID_LEN; i > UUID_LEN / 2; --i) {
+    buf[i - 1] = digits[rnd & 0xf];
+    rnd >>= 4;
+  }
+}
 
-  // 生成4位16进制字符 --- 2字节
-  static std::atomic<short> idx(0);
-  short tmp = idx.fetch_add(1);
-  ss << std::setw(4) << std::setfill('0') << std::hex << tmp;
-
-  return ss.str();
+std::string uuid() {
+  char buf[UUID_LEN];
+  uuid(buf);
+  return std::string(buf, UUID_LEN);
 }
 
-// 随机生成6位数字验证码
-std::string verify_code() {
-  std::random_device rd;         // 设备随机数，真随机但效率低，作为种子
-  std::mt19937 generator(rd());  // 生成伪随机数
-  std::uniform_int_distribution<int> distribution(0, 9);  // 限定随机数范围
+// 密码学安全的随机字节，取自内核 getrandom
+void secure_random(void* buf, size_t len) {
+  auto p = static_cast<unsigned char*>(buf);
+  while (len > 0) {
+    ssize_t n = getrandom(p, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR("获取系统随机数失败: {}", errno);
+      abort();
+    }
+    p += n;
+    len -= n;
+  }
+}
 
-  std::stringstream ss;
-  for (size_t i = 0; i < 6; ++i) {
-    ss << distribution(generator);
+// 不可预测的令牌：128位安全随机数的32位16进制表示，用于登录会话id等
+std::string secure_token() {
+  static const char digits[] = "0123456789abcdef";
+  unsigned char rnd[16];
+  secure_random(rnd, sizeof(rnd));
+  std::string token(sizeof(rnd) * 2, '0');
+  for (size_t i = 0; i < sizeof(rnd); ++i) {
+    token[2 * i] = digits[rnd[i] >> 4];
+    token[2 * i + 1] = digits[rnd[i] & 0xf];
   }
+  return token;
+}
 
-  return ss.str();
+// 随机生成6位数字验证码，丢弃250及以上的字节以避免取模偏差
+std::string verify_code() {
+  std::string code;
+  unsigned char rnd[16];
+  while (code.size() < 6) {
+    secure_random(rnd, sizeof(rnd));
+    for (size_t i = 0; i < sizeof(rnd) && code.size() < 6; ++i) {
+      if (rnd[i] < 250) {
+        code.push_back('0' + rnd[i] % 10);
+      }
+    }
+  }
+  return code;
 }
 
 bool read_file(const std::string& file_name, std::string& body) {
@@ -0,0 +1,13 @@
+#pragma once
+#include <odb/core.hxx>
+
+namespace huzch {
+
+// 从库复制延迟：主库周期性写入 heartbeat 表，从库读取与当前时间的差值
+#pragma db view query("SELECT TIMESTAMPDIFF(MICROSECOND, `ts`, NOW(6)) " \
+                      "FROM `heartbeat` WHERE `id` = 1")
+struct ReplicaLag {
+  long long lag;  // 微秒
+};
+
+}  // namespace huzch
\ No newline at end of file
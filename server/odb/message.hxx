@@ -20,6 +20,8 @@ class Message {
         _message_type(message_type),
         _create_time(create_time) {}
 
+  unsigned long id() const { return _id; }
+
   void message_id(const std::string& val) { _message_id = val; }
   std::string message_id() const { return _message_id; }
 
@@ -35,6 +37,9 @@ class Message {
   void create_time(const boost::posix_time::ptime& val) { _create_time = val; }
   boost::posix_time::ptime create_time() const { return _create_time; }
 
+  void seq(const unsigned long long val) { _seq = val; }
+  unsigned long long seq() const { return _seq; }
+
   void content(const std::string& val) { _content = val; }
   std::string content() const {
     if (_content.null()) {
@@ -71,21 +76,72 @@ class Message {
   friend class odb::access;
 #pragma db id auto
   unsigned long _id;
-#pragma db type("varchar(64)") index unique
+#pragma db type("varchar(64)")
   std::string _message_id;
-#pragma db type("varchar(64)") index
+#pragma db type("varchar(64)")
   std::string _session_id;
 #pragma db type("varchar(64)")
   std::string _user_id;
   unsigned char _message_type;  // 0:string, 1:speech, 2:image, 3:file
-#pragma db type("timestamp")
-  boost::posix_time::ptime _create_time;
+#pragma db type("timestamp") not_null
+  boost::posix_time::ptime _create_time;  // 分区键
+  unsigned long long _seq = 0;  // 会话内单调递增序号
   odb::nullable<std::string> _content;  // string
 #pragma db type("varchar(64)")
   odb::nullable<std::string> _file_id;  // not string
 #pragma db type("varchar(64)")
   odb::nullable<std::string> _file_name;   // not string
   odb::nullable<unsigned int> _file_size;  // not string
+
+// 分区表的唯一索引须包含分区键；消息重投时同一消息的 create_time 不变，
+// 以 (message_id, create_time) 唯一约束拦截重复写入
+#pragma db index("message_id_create_time_i") unique members(_message_id, _create_time)
+// 会话内按时间排序的复合索引，最近消息与键集分页走索引范围扫描
+#pragma db index("session_id_create_time_i") members(_session_id, _create_time)
+// 会话内按序号排序的复合索引，增量同步走索引范围扫描
+#pragma db index("session_id_seq_i") members(_session_id, _seq)
+};
+
+// 会话已归档消息的最大序号：分区删除后仍可据此恢复会话序号计数器
+#pragma db object table("message_seq")
+class MessageSeq {
+ public:
+  MessageSeq() {}
+
+  MessageSeq(const std::string& session_id, const unsigned long long seq)
+      : _session_id(session_id), _seq(seq) {}
+
+  std::string session_id() const { return _session_id; }
+
+  void seq(const unsigned long long val) { _seq = val; }
+  unsigned long long seq() const { return _seq; }
+
+ private:
+  friend class odb::access;
+#pragma db id type("varchar(64)")
+  std::string _session_id;
+  unsigned long long _seq = 0;
+};
+
+// 归档互斥锁：多个消息服务实例中同一时刻只有一个执行归档，
+// 锁随连接断开自动释放
+#pragma db view query("SELECT GET_LOCK('message_archiver', 0)")
+struct ArchiveLock {
+  odb::nullable<int> acquired;  // 1获取成功，0已被其他实例持有，NULL出错
+};
+
+// message表的分区信息，由归档线程维护按月分区
+#pragma db view query("SELECT PARTITION_NAME, PARTITION_DESCRIPTION "      \
+                      "FROM information_schema.PARTITIONS "                \
+                      "WHERE TABLE_SCHEMA = DATABASE() "                   \
+                      "AND TABLE_NAME = 'message' "                        \
+                      "AND PARTITION_NAME IS NOT NULL "                    \
+                      "ORDER BY PARTITION_ORDINAL_POSITION")
+struct MessagePartition {
+#pragma db type("varchar(64)")
+  std::string name;
+#pragma db type("text")
+  std::string description;  // 分区上界(秒级时间戳)或MAXVALUE
 };
 
 }  // namespace huzch
\ No newline at end of file
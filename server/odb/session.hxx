@@ -20,6 +20,8 @@ class Session {
         _session_name(session_name),
         _session_type(session_type) {}
 
+  unsigned long id() const { return _id; }
+
   void session_id(const std::string& val) { _session_id = val; }
   std::string session_id() const { return _session_id; }
 
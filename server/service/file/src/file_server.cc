@@ -5,6 +5,12 @@
 DEFINE_bool(run_mode, true, "程序运行模式: true调试/false发布");
 DEFINE_string(log_file, "", "发布模式下日志文件");
 DEFINE_int32(log_level, 0, "发布模式下日志等级");
+DEFINE_bool(log_async, true, "是否异步写日志");
+DEFINE_int32(log_queue_size, 8192, "异步日志队列容量");
+DEFINE_string(log_overflow, "block", "异步日志队列满时策略: block阻塞/overrun覆盖最旧");
+DEFINE_int32(log_flush_interval, 3, "异步日志定期刷盘间隔(秒)");
+DEFINE_int32(log_field_max, 512, "结构化日志单个字段最大字节数");
+DEFINE_string(trace_file, "", "链路追踪文件，为空时不开启追踪");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "etcd服务器地址");
 DEFINE_string(base_dir, "/service", "服务根目录");
@@ -20,7 +26,15 @@ DEFINE_string(storage_path, "./data", "文件存储路径");
 
 int main(int argc, char* argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
-  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+  huzch::LoggerOptions logger_options;
+  logger_options.async = FLAGS_log_async;
+  logger_options.queue_size = FLAGS_log_queue_size;
+  logger_options.overflow = FLAGS_log_overflow;
+  logger_options.flush_interval = FLAGS_log_flush_interval;
+  logger_options.field_max = FLAGS_log_field_max;
+  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level,
+                     logger_options);
+  huzch::Tracer::init("file", FLAGS_trace_file);
 
   huzch::FileServerBuilder fsb;
 
@@ -3,6 +3,7 @@
 
 #include "base.pb.h"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "file.pb.h"
 #include "utils.hpp"
 
@@ -154,7 +155,7 @@ class FileServerBuilder {
                        const std::string& storage_path) {
     _server = std::make_shared<brpc::Server>();
     auto file_service = new FileServiceImpl(storage_path);
-    int ret = _server->AddService(file_service,
+    int ret = _server->AddService(new TracedService(file_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
@@ -1,12 +1,20 @@
 #pragma once
 #include <brpc/server.h>
+#include <bthread/bthread.h>
+#include <bthread/countdown_event.h>
+#include <bvar/bvar.h>
 
 #include "base.pb.h"
 #include "channel.hpp"
-#include "data_mysql_session_member.hpp"
+#include "data_mysql_message.hpp"
+#include "data_redis.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
+#include "file.pb.h"
 #include "forward.pb.h"
+#include "member_cache.hpp"
 #include "mq.hpp"
+#include "profile_cache.hpp"
 #include "user.pb.h"
 #include "utils.hpp"
 
@@ -14,16 +22,27 @@ namespace huzch {
 
 class ForwardServiceImpl : public ForwardService {
  public:
-  ForwardServiceImpl(const std::shared_ptr<odb::core::database>& mysql_client,
-                     const std::string& exchange_name,
-                     const MQClient::Ptr& mq_client,
+  ForwardServiceImpl(const MemberCache::Ptr& member_cache,
+                     const ProfileCache::Ptr& profile_cache, bool slim_sender,
+                     const ShardedDatabase::Ptr& mysql_client,
+                     const RedisClient::Ptr& redis_client,
+                     const MQBinding& text_binding,
+                     const MQBinding& media_binding,
+                     const MQClient::Ptr& mq_client, int publish_timeout,
                      const std::string& user_service_name,
+                     const std::string& file_service_name,
                      const ChannelManager::Ptr& channels)
-      : _mysql_session_member(
-            std::make_shared<SessionMemberTable>(mysql_client)),
-        _exchange_name(exchange_name),
+      : _member_cache(member_cache),
+        _profile_cache(profile_cache),
+        _slim_sender(slim_sender),
+        _mysql_message(std::make_shared<MessageTable>(mysql_client)),
+        _redis_sequence(std::make_shared<Sequence>(redis_client)),
+        _text_binding(text_binding),
+        _media_binding(media_binding),
         _mq_client(mq_client),
+        _publish_timeout(publish_timeout),
         _user_service_name(user_service_name),
+        _file_service_name(file_service_name),
         _channels(channels) {}
 
   void NewMessage(google::protobuf::RpcController* controller,
@@ -39,62 +58,351 @@ class ForwardServiceImpl : public ForwardService {
     };
     std::string user_id = request->user_id();
     std::string chat_session_id = request->chat_session_id();
-    const MessageContent& content = request->message();
+    MessageContent content = request->message();
+
+    butil::Timer total_timer;
+    total_timer.start();
+
+    // 媒体上传、发送者资料、会话成员互不依赖，并发执行：
+    // 媒体上传与未命中缓存的发送者资料发起异步rpc，会话成员在后台bthread
+    // 中获取，总耗时取决于最慢的一步
+    MediaUpload upload;
+    start_upload(request_id, user_id, content, upload);
+
+    SenderFetch sender;
+    start_fetch_sender(request_id, user_id, sender);
+
+    MembersFetch members(this, chat_session_id);
+    bthread_t tid;
+    if (bthread_start_background(&tid, nullptr,
+                                 &ForwardServiceImpl::fetch_members,
+                                 &members) != 0) {
+      fetch_members(&members);
+      tid = INVALID_BTHREAD;
+    }
 
-    auto channel = _channels->get(_user_service_name);
-    if (!channel) {
-      LOG_ERROR("{} 未找到 {} 服务节点", request_id, _user_service_name);
-      err_rsp("未找到服务节点");
+    if (tid != INVALID_BTHREAD) {
+      bthread_join(tid, nullptr);
+    }
+    // 先等待全部异步调用结束再检查结果，提前返回时 upload、sender
+    // 中的 ctrl 与 rsp 不能仍被进行中的rpc引用
+    bool uploaded = finish_upload(request_id, content, upload);
+    bool fetched = finish_fetch_sender(request_id, sender);
+    if (!uploaded) {
+      LOG_ERROR("{} 上传媒体消息文件失败", request_id);
+      err_rsp("上传媒体消息文件失败");
       return;
     }
 
-    huzch::UserService_Stub stub(channel.get());
-    brpc::Controller ctrl;
-    huzch::GetUserInfoReq req;
-    req.set_request_id(request_id);
-    req.set_user_id(user_id);
-    huzch::GetUserInfoRsp rsp;
+    if (!fetched) {
+      LOG_ERROR("{} 获取发送者 {} 资料失败", request_id, user_id);
+      err_rsp("获取发送者资料失败");
+      return;
+    }
 
-    stub.GetUserInfo(&ctrl, &req, &rsp, nullptr);
-    if (ctrl.Failed() || !rsp.success()) {
-      LOG_ERROR("{} {} 服务调用失败: {} {}", request_id, _user_service_name,
-                ctrl.ErrorText(), rsp.errmsg());
-      err_rsp("服务调用失败");
+    if (!members.members_id) {
+      LOG_ERROR("{} 获取会话 {} 成员失败", request_id, chat_session_id);
+      err_rsp("获取会话成员失败");
       return;
     }
 
-    MessageInfo message_info;
-    message_info.set_message_id(uuid());
-    message_info.set_chat_session_id(chat_session_id);
-    message_info.set_timestamp(time(nullptr));
-    message_info.mutable_sender()->CopyFrom(rsp.user_info());
-    message_info.mutable_message()->CopyFrom(content);
+    // 序号在全部校验通过后分配，被拒绝的发送不会在会话内留下序号空洞
+    butil::Timer seq_timer;
+    seq_timer.start();
+    long long seq = next_seq(chat_session_id);
+    seq_timer.stop();
+    _seq_latency << seq_timer.u_elapsed();
+    if (seq <= 0) {
+      LOG_ERROR("{} 分配消息序号失败", request_id);
+      err_rsp("分配消息序号失败");
+      return;
+    }
 
-    auto members = _mysql_session_member->members(chat_session_id);
+    auto message_info = response->mutable_message_info();
+    message_info->set_message_id(uuid());
+    message_info->set_chat_session_id(chat_session_id);
+    message_info->set_timestamp(time(nullptr));
+    message_info->set_seq(seq);
+    message_info->mutable_sender()->Swap(&sender.user_info);
+    message_info->mutable_message()->Swap(&content);
+    MessageType message_type = message_info->message().message_type();
+
+    // 将封装好的消息信息发布到消息队列，等待消息服务进行消息持久化；
+    // 等待broker确认期间填充转发目标，确认后才向网关返回成功
+    butil::Timer publish_timer;
+    publish_timer.start();
+    // 等待状态由回调共同持有，超时返回后迟到的确认不会访问已释放的栈
+    auto published = std::make_shared<PublishWait>();
+    // 文本与媒体消息走不同队列，大体积媒体消息不阻塞文本消息持久化；
+    // 以会话id作为lane键，同一队列内同一会话的消息仍按序持久化
+    const MQBinding& binding = message_type == MessageType::STRING
+                                   ? _text_binding
+                                   : _media_binding;
+    _mq_client->publish(
+        binding.exchange, message_info->SerializeAsString(),
+        [published](bool ret) {
+          published->confirmed = ret;
+          published->done.signal();
+        },
+        binding.routing_key, chat_session_id);
+
+    for (auto& member_id : *members.members_id) {
+      response->add_targets_id(member_id);
+    }
 
-    // 将封装好的消息信息发布到消息队列，等待消息服务进行消息持久化
-    bool ret =
-        _mq_client->publish(_exchange_name, message_info.SerializeAsString());
-    if (!ret) {
+    int timeout = published->done.timed_wait(
+        butil::milliseconds_from_now(_publish_timeout));
+    publish_timer.stop();
+    _publish_latency << publish_timer.u_elapsed();
+    if (timeout != 0) {
+      LOG_ERROR("{} 持久化消息发布等待确认超时", request_id);
+      response->clear_message_info();
+      response->clear_targets_id();
+      err_rsp("持久化消息发布超时");
+      return;
+    }
+    if (!published->confirmed) {
       LOG_ERROR("{} 持久化消息发布失败", request_id);
+      response->clear_message_info();
+      response->clear_targets_id();
       err_rsp("持久化消息发布失败");
       return;
     }
 
     response->set_success(true);
-    response->mutable_message_info()->CopyFrom(message_info);
-    for (auto& member : members) {
-      response->add_targets_id(member.user_id());
-    }
+
+    total_timer.stop();
+    _total_latency << total_timer.u_elapsed();
   }
 
  private:
-  SessionMemberTable::Ptr _mysql_session_member;
+  // 媒体文件上传：消息队列与推送只携带文件id，文件数据在发送时写入文件服务
+  struct MediaUpload {
+    bool pending = false;
+    bool success = true;
+    ServiceChannel::ChannelPtr channel;
+    brpc::Controller ctrl;
+    PutSingleFileReq req;
+    PutSingleFileRsp rsp;
+  };
+
+  // 发送者资料获取：缓存命中或精简模式时立即完成，否则发起异步rpc
+  struct SenderFetch {
+    UserInfo user_info;
+    bool pending = false;
+    bool success = false;
+    ServiceChannel::ChannelPtr channel;
+    brpc::Controller ctrl;
+    GetUserInfoReq req;
+    GetUserInfoRsp rsp;
+  };
+
+  // 等待broker确认发布结果
+  struct PublishWait {
+    bthread::CountdownEvent done{1};
+    std::atomic<bool> confirmed{false};
+  };
+
+  // 会话成员获取，在后台bthread中执行
+  struct MembersFetch {
+    MembersFetch(ForwardServiceImpl* service, const std::string& session_id)
+        : service(service), session_id(session_id), parent(Span::current()) {}
+
+    ForwardServiceImpl* service;
+    std::string session_id;
+    MemberCache::MembersPtr members_id;
+    Span* parent;  // 发起方的 span，后台bthread不继承当前 span
+  };
+
+  static void* fetch_members(void* arg) {
+    auto fetch = static_cast<MembersFetch*>(arg);
+    Span span("fetch_members", fetch->parent);
+    SpanScope scope(&span);
+    butil::Timer timer;
+    timer.start();
+    fetch->members_id =
+        fetch->service->_member_cache->members(fetch->session_id);
+    timer.stop();
+    fetch->service->_members_latency << timer.u_elapsed();
+    return nullptr;
+  }
+
+  // 计数器不存在时以mysql中已持久化(含已归档)的最大序号初始化，
+  // redis 数据丢失后序号不会从1重新开始
+  long long next_seq(const std::string& session_id) {
+    long long seq = _redis_sequence->next(session_id);
+    if (seq != 0) {
+      return seq;
+    }
+    unsigned long long max_seq = 0;
+    if (!_mysql_message->max_seq(session_id, max_seq) ||
+        !_redis_sequence->seed(session_id, max_seq)) {
+      return -1;
+    }
+    return _redis_sequence->next(session_id);
+  }
+
+  // 精简模式下只携带 user_id 与资料版本，由客户端按版本自行拉取资料
+  void start_fetch_sender(const std::string& request_id,
+                          const std::string& user_id, SenderFetch& fetch) {
+    if (_slim_sender) {
+      long long version = _profile_cache->version(user_id);
+      if (version >= 0) {
+        fetch.user_info.set_user_id(user_id);
+        fetch.user_info.set_profile_version(version);
+        fetch.success = true;
+      }
+      return;
+    }
+
+    auto profile = _profile_cache->get(user_id);
+    if (profile) {
+      fetch.user_info.CopyFrom(*profile);
+      fetch.success = true;
+      return;
+    }
+
+    // 异步调用期间信道须保持有效，由 fetch 持有
+    fetch.channel = _channels->get(_user_service_name);
+    if (!fetch.channel) {
+      LOG_ERROR("{} 未找到 {} 服务节点", request_id, _user_service_name);
+      return;
+    }
+
+    huzch::UserService_Stub stub(fetch.channel.get());
+    fetch.req.set_request_id(request_id);
+    fetch.req.set_user_id(user_id);
+    stub.GetUserInfo(&fetch.ctrl, &fetch.req, &fetch.rsp, brpc::DoNothing());
+    fetch.pending = true;
+  }
+
+  // 未携带文件id的语音、图片、文件消息需要上传
+  static std::string* media_content(MessageContent& content) {
+    switch (content.message_type()) {
+      case MessageType::SPEECH:
+        if (content.speech_message().file_id().empty()) {
+          return content.mutable_speech_message()->mutable_file_content();
+        }
+        return nullptr;
+      case MessageType::IMAGE:
+        if (content.image_message().file_id().empty()) {
+          return content.mutable_image_message()->mutable_file_content();
+        }
+        return nullptr;
+      case MessageType::FILE:
+        if (content.file_message().file_id().empty()) {
+          return content.mutable_file_message()->mutable_file_content();
+        }
+        return nullptr;
+      default:
+        return nullptr;
+    }
+  }
+
+  void start_upload(const std::string& request_id, const std::string& user_id,
+                    MessageContent& content, MediaUpload& upload) {
+    std::string* file_content = media_content(content);
+    if (!file_content) {
+      return;
+    }
+
+    upload.channel = _channels->get(_file_service_name);
+    if (!upload.channel) {
+      LOG_ERROR("{} 未找到 {} 服务节点", request_id, _file_service_name);
+      upload.success = false;
+      return;
+    }
+
+    huzch::FileService_Stub stub(upload.channel.get());
+    upload.req.set_request_id(request_id);
+    upload.req.set_user_id(user_id);
+    auto file_data = upload.req.mutable_file_data();
+    if (content.message_type() == MessageType::FILE) {
+      file_data->set_file_name(content.file_message().file_name());
+    }
+    file_data->set_file_size(file_content->size());
+    file_data->mutable_file_content()->swap(*file_content);
+    stub.PutSingleFile(&upload.ctrl, &upload.req, &upload.rsp,
+                       brpc::DoNothing());
+    upload.pending = true;
+  }
+
+  bool finish_upload(const std::string& request_id, MessageContent& content,
+                     MediaUpload& upload) {
+    if (!upload.pending) {
+      return upload.success;
+    }
+
+    brpc::Join(upload.ctrl.call_id());
+    _upload_latency << upload.ctrl.latency_us();
+    if (upload.ctrl.Failed() || !upload.rsp.success()) {
+      LOG_ERROR("{} {} 服务调用失败: {} {}", request_id, _file_service_name,
+                upload.ctrl.ErrorText(), upload.rsp.errmsg());
+      return false;
+    }
+
+    const std::string& file_id = upload.rsp.file_info().file_id();
+    switch (content.message_type()) {
+      case MessageType::SPEECH:
+        content.mutable_speech_message()->set_file_id(file_id);
+        content.mutable_speech_message()->clear_file_content();
+        break;
+      case MessageType::IMAGE:
+        content.mutable_image_message()->set_file_id(file_id);
+        content.mutable_image_message()->clear_file_content();
+        break;
+      case MessageType::FILE:
+        content.mutable_file_message()->set_file_id(file_id);
+        content.mutable_file_message()->set_file_size(
+            upload.req.file_data().file_size());
+        content.mutable_file_message()->clear_file_content();
+        break;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  bool finish_fetch_sender(const std::string& request_id, SenderFetch& fetch) {
+    if (!fetch.pending) {
+      return fetch.success;
+    }
 
-  std::string _exchange_name;
+    brpc::Join(fetch.ctrl.call_id());
+    _sender_latency << fetch.ctrl.latency_us();
+    if (fetch.ctrl.Failed() || !fetch.rsp.success()) {
+      LOG_ERROR("{} {} 服务调用失败: {} {}", request_id, _user_service_name,
+                fetch.ctrl.ErrorText(), fetch.rsp.errmsg());
+      return false;
+    }
+
+    _profile_cache->put(fetch.rsp.user_info());
+    fetch.user_info.Swap(fetch.rsp.mutable_user_info());
+    return true;
+  }
+
+ private:
+  MemberCache::Ptr _member_cache;
+  ProfileCache::Ptr _profile_cache;
+  bool _slim_sender;
+  MessageTable::Ptr _mysql_message;
+  Sequence::Ptr _redis_sequence;
+
+  MQBinding _text_binding;
+  MQBinding _media_binding;
   MQClient::Ptr _mq_client;
+  int _publish_timeout;  // 等待broker确认的超时时间(ms)
   std::string _user_service_name;
+  std::string _file_service_name;
   ChannelManager::Ptr _channels;
+
+  // 发送链路各阶段耗时，可通过 brpc 内置服务的 /vars 查看
+  bvar::LatencyRecorder _upload_latency{"forward_new_message_upload"};
+  bvar::LatencyRecorder _sender_latency{"forward_new_message_sender"};
+  bvar::LatencyRecorder _members_latency{"forward_new_message_members"};
+  bvar::LatencyRecorder _seq_latency{"forward_new_message_seq"};
+  bvar::LatencyRecorder _publish_latency{"forward_new_message_publish"};
+  bvar::LatencyRecorder _total_latency{"forward_new_message_total"};
 };
 
 class ForwardServer {
@@ -123,10 +431,13 @@ class ForwardServerBuilder {
 
   void init_discovery_client(const std::string& registry_host,
                              const std::string& base_dir,
-                             const std::string& service_name) {
-    _user_service_name = base_dir + service_name;
+                             const std::string& user_service_name,
+                             const std::string& file_service_name) {
+    _user_service_name = base_dir + user_service_name;
+    _file_service_name = base_dir + file_service_name;
     _channels = std::make_shared<ChannelManager>();
-    _channels->declare(base_dir + service_name);
+    _channels->declare(base_dir + user_service_name);
+    _channels->declare(base_dir + file_service_name);
     auto put_cb = std::bind(&ChannelManager::on_service_online, _channels.get(),
                             std::placeholders::_1, std::placeholders::_2);
     auto del_cb =
@@ -138,19 +449,58 @@ class ForwardServerBuilder {
   }
 
   void init_mq_client(const std::string& user, const std::string& passwd,
-                      const std::string& host, const std::string& exchange,
-                      const std::string& queue, const std::string& routing_key) {
-    _exchange_name = exchange;
+                      const std::string& host, const MQBinding& text_binding,
+                      const MQBinding& media_binding, int publish_timeout) {
+    if (publish_timeout <= 0) {
+      LOG_ERROR("消息发布确认超时时间须大于0: {}", publish_timeout);
+      abort();
+    }
+    _publish_timeout = publish_timeout;
+    _text_binding = text_binding;
+    _media_binding = media_binding;
     _mq_client = std::make_shared<MQClient>(user, passwd, host);
-    _mq_client->declare(exchange, queue, routing_key);
+    _mq_client->declare(text_binding);
+    _mq_client->declare(media_binding);
   }
 
   void init_mysql_client(const std::string& user, const std::string& passwd,
                          const std::string& db, const std::string& host,
-                         size_t port, const std::string& charset,
-                         size_t max_connections) {
-    _mysql_client = MysqlClientFactory::create(user, passwd, db, host, port,
-                                               charset, max_connections);
+                         size_t port, const std::string& replica_hosts,
+                         const std::string& shard_hosts,
+                         const std::string& charset, size_t max_connections,
+                         size_t min_connections, int max_lag, int ryw_window) {
+    _mysql_client = ShardedDatabaseFactory::create(
+        user, passwd, db, host, port, replica_hosts, shard_hosts, charset,
+        max_connections, min_connections, max_lag, ryw_window);
+  }
+
+  void init_redis_client(const RedisOptions& options) {
+    _redis_client = RedisClientFactory::create(options);
+  }
+
+  void init_member_cache(size_t capacity) {
+    if (!_mysql_client) {
+      LOG_ERROR("未初始化mysql数据库模块");
+      abort();
+    }
+
+    if (!_redis_client) {
+      LOG_ERROR("未初始化redis数据库模块");
+      abort();
+    }
+
+    _member_cache =
+        std::make_shared<MemberCache>(_mysql_client, _redis_client, capacity);
+  }
+
+  void init_profile_cache(size_t capacity, bool slim_sender) {
+    if (!_redis_client) {
+      LOG_ERROR("未初始化redis数据库模块");
+      abort();
+    }
+
+    _slim_sender = slim_sender;
+    _profile_cache = std::make_shared<ProfileCache>(_redis_client, capacity);
   }
 
   void init_rpc_server(int port, int timeout, int num_threads) {
@@ -159,16 +509,28 @@ class ForwardServerBuilder {
       abort();
     }
 
+    if (!_member_cache) {
+      LOG_ERROR("未初始化会话成员缓存模块");
+      abort();
+    }
+
+    if (!_profile_cache) {
+      LOG_ERROR("未初始化用户资料缓存模块");
+      abort();
+    }
+
     if (!_mysql_client) {
       LOG_ERROR("未初始化mysql数据库模块");
       abort();
     }
 
     _server = std::make_shared<brpc::Server>();
-    auto forward_service =
-        new ForwardServiceImpl(_mysql_client, _exchange_name, _mq_client,
-                               _user_service_name, _channels);
-    int ret = _server->AddService(forward_service,
+    auto forward_service = new ForwardServiceImpl(
+        _member_cache, _profile_cache, _slim_sender, _mysql_client,
+        _redis_client,
+        _text_binding, _media_binding, _mq_client, _publish_timeout,
+        _user_service_name, _file_service_name, _channels);
+    int ret = _server->AddService(new TracedService(forward_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
@@ -212,12 +574,19 @@ class ForwardServerBuilder {
  private:
   ServiceRegistry::Ptr _registry_client;
   ServiceDiscovery::Ptr _discovery_client;
-  std::string _exchange_name;
+  MQBinding _text_binding;
+  MQBinding _media_binding;
   MQClient::Ptr _mq_client;
-  std::shared_ptr<odb::core::database> _mysql_client;
+  int _publish_timeout = 0;
+  ShardedDatabase::Ptr _mysql_client;
+  RedisClient::Ptr _redis_client;
+  MemberCache::Ptr _member_cache;
+  ProfileCache::Ptr _profile_cache;
+  bool _slim_sender = false;
   std::shared_ptr<brpc::Server> _server;
 
   std::string _user_service_name;
+  std::string _file_service_name;
   ChannelManager::Ptr _channels;
 };
 
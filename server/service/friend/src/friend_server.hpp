@@ -7,8 +7,10 @@
 #include "data_mysql_relation.hpp"
 #include "data_mysql_session.hpp"
 #include "data_mysql_session_member.hpp"
+#include "data_redis_members.hpp"
 #include "data_search.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "friend.pb.h"
 #include "message.pb.h"
 #include "user.pb.h"
@@ -18,16 +20,19 @@ namespace huzch {
 
 class FriendServiceImpl : public FriendService {
  public:
-  FriendServiceImpl(const std::shared_ptr<odb::core::database>& mysql_client,
+  FriendServiceImpl(const ShardedDatabase::Ptr& mysql_client,
+                    const RedisClient::Ptr& redis_client,
                     const std::string& user_service_name,
                     const std::string& message_service_name,
                     const ChannelManager::Ptr& channels)
       : _mysql_session(std::make_shared<SessionTable>(mysql_client)),
         _mysql_session_member(
             std::make_shared<SessionMemberTable>(mysql_client)),
-        _mysql_relation(std::make_shared<RelationTable>(mysql_client)),
+        _mysql_relation(
+            std::make_shared<RelationTable>(mysql_client->global())),
         _mysql_friend_request(
-            std::make_shared<FriendRequestTable>(mysql_client)),
+            std::make_shared<FriendRequestTable>(mysql_client->global())),
+        _redis_members(std::make_shared<Members>(redis_client)),
         _user_service_name(user_service_name),
         _message_service_name(message_service_name),
         _channels(channels) {}
@@ -46,6 +51,13 @@ class FriendServiceImpl : public FriendService {
     std::string user_id = request->user_id();
 
     auto friends_id = _mysql_relation->friends_id(user_id);
+    if (request->id_only()) {
+      for (auto& friend_id : friends_id) {
+        response->add_friends_info()->set_user_id(friend_id);
+      }
+      response->set_success(true);
+      return;
+    }
 
     std::unordered_set<std::string> users_id;
     for (auto& friend_id : friends_id) {
@@ -95,6 +107,13 @@ class FriendServiceImpl : public FriendService {
       return;
     }
 
+    ret = _redis_members->remove(chat_session_id);
+    if (!ret) {
+      LOG_ERROR("{} redis移除好友会话成员失败", request_id);
+      err_rsp("redis移除好友会话成员失败");
+      return;
+    }
+
     response->set_success(true);
   }
 
@@ -193,6 +212,11 @@ class FriendServiceImpl : public FriendService {
       return;
     }
 
+    // redis写入失败时转发服务会回源mysql，不影响本次请求
+    if (!_redis_members->insert(chat_session_id, {requester_id, user_id})) {
+      LOG_WARN("{} redis新增会话成员失败", request_id);
+    }
+
     response->set_success(true);
     response->set_chat_session_id(chat_session_id);
   }
@@ -331,6 +355,12 @@ class FriendServiceImpl : public FriendService {
       return;
     }
 
+    std::vector<std::string> members_id(request->members_id().begin(),
+                                        request->members_id().end());
+    if (!_redis_members->insert(chat_session_id, members_id)) {
+      LOG_WARN("{} redis新增会话成员失败", request_id);
+    }
+
     response->set_success(true);
     response->mutable_chat_session_info()->set_chat_session_id(chat_session_id);
     response->mutable_chat_session_info()->set_chat_session_name(
@@ -441,6 +471,7 @@ class FriendServiceImpl : public FriendService {
   SessionMemberTable::Ptr _mysql_session_member;
   RelationTable::Ptr _mysql_relation;
   FriendRequestTable::Ptr _mysql_friend_request;
+  Members::Ptr _redis_members;
 
   std::string _user_service_name;
   std::string _message_service_name;
@@ -491,10 +522,17 @@ class FriendServerBuilder {
 
   void init_mysql_client(const std::string& user, const std::string& passwd,
                          const std::string& db, const std::string& host,
-                         size_t port, const std::string& charset,
-                         size_t max_connections) {
-    _mysql_client = MysqlClientFactory::create(user, passwd, db, host, port,
-                                               charset, max_connections);
+                         size_t port, const std::string& replica_hosts,
+                         const std::string& shard_hosts,
+                         const std::string& charset, size_t max_connections,
+                         size_t min_connections, int max_lag, int ryw_window) {
+    _mysql_client = ShardedDatabaseFactory::create(
+        user, passwd, db, host, port, replica_hosts, shard_hosts, charset,
+        max_connections, min_connections, max_lag, ryw_window);
+  }
+
+  void init_redis_client(const RedisOptions& options) {
+    _redis_client = RedisClientFactory::create(options);
   }
 
   void init_rpc_server(int port, int timeout, int num_threads) {
@@ -503,10 +541,16 @@ class FriendServerBuilder {
       abort();
     }
 
+    if (!_redis_client) {
+      LOG_ERROR("未初始化redis数据库模块");
+      abort();
+    }
+
     _server = std::make_shared<brpc::Server>();
-    auto friend_service = new FriendServiceImpl(
-        _mysql_client, _user_service_name, _message_service_name, _channels);
-    int ret = _server->AddService(friend_service,
+    auto friend_service =
+        new FriendServiceImpl(_mysql_client, _redis_client, _user_service_name,
+                              _message_service_name, _channels);
+    int ret = _server->AddService(new TracedService(friend_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
@@ -550,7 +594,8 @@ class FriendServerBuilder {
  private:
   ServiceRegistry::Ptr _registry_client;
   ServiceDiscovery::Ptr _discovery_client;
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ShardedDatabase::Ptr _mysql_client;
+  RedisClient::Ptr _redis_client;
   std::shared_ptr<brpc::Server> _server;
 
   std::string _user_service_name;
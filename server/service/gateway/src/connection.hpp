@@ -1,4 +1,8 @@
 #pragma once
+#include <bvar/bvar.h>
+
+#include <chrono>
+#include <vector>
 #include <websocketpp/config/asio_no_tls.hpp>
 #include <websocketpp/server.hpp>
 
@@ -9,10 +13,13 @@ namespace huzch {
 struct ClientInfo {
   ClientInfo(const std::string& user_id = "",
              const std::string& session_id = "")
-      : _user_id(user_id), _session_id(session_id) {}
+      : _user_id(user_id),
+        _session_id(session_id),
+        _last_active(std::chrono::steady_clock::now()) {}
 
   std::string _user_id;
   std::string _session_id;
+  std::chrono::steady_clock::time_point _last_active;
 };
 
 class ConnectionManager {
@@ -26,6 +33,9 @@ class ConnectionManager {
               const std::string& session_id) {
     std::lock_guard<std::mutex> lock(_mutex);
     _user_connection_map[user_id] = connection;
+    if (!_connection_client_map.count(connection)) {
+      _connection_count << 1;
+    }
     _connection_client_map[connection] = {user_id, session_id};
   }
 
@@ -39,6 +49,7 @@ class ConnectionManager {
     auto client_info = _connection_client_map[connection];
     _user_connection_map.erase(client_info._user_id);
     _connection_client_map.erase(connection);
+    _connection_count << -1;
   }
 
   bool client(const ConnectionPtr& connection, std::string& user_id,
@@ -55,6 +66,35 @@ class ConnectionManager {
     return true;
   }
 
+  // 收到消息或心跳回应时刷新活跃时间
+  void touch(const ConnectionPtr& connection) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _connection_client_map.find(connection);
+    if (it != _connection_client_map.end()) {
+      it->second._last_active = std::chrono::steady_clock::now();
+    }
+  }
+
+  // 按活跃时间划分连接：timeout 内活跃过的连接放入 alive 并返回其客户端信息，
+  // 超时未活跃的连接放入 stale
+  void sweep(const std::chrono::steady_clock::duration& timeout,
+             std::vector<ConnectionPtr>& alive,
+             std::vector<std::pair<std::string, std::string>>& clients,
+             std::vector<ConnectionPtr>& stale) {
+    auto deadline = std::chrono::steady_clock::now() - timeout;
+    std::lock_guard<std::mutex> lock(_mutex);
+    alive.reserve(_connection_client_map.size());
+    clients.reserve(_connection_client_map.size());
+    for (const auto& [connection, client_info] : _connection_client_map) {
+      if (client_info._last_active < deadline) {
+        stale.push_back(connection);
+      } else {
+        alive.push_back(connection);
+        clients.emplace_back(client_info._user_id, client_info._session_id);
+      }
+    }
+  }
+
   ConnectionPtr get(const std::string& user_id) {
     std::lock_guard<std::mutex> lock(_mutex);
     if (!_user_connection_map.count(user_id)) {
@@ -68,6 +108,7 @@ class ConnectionManager {
   std::unordered_map<std::string, ConnectionPtr> _user_connection_map;
   std::unordered_map<ConnectionPtr, ClientInfo> _connection_client_map;
   std::mutex _mutex;
+  bvar::Adder<int64_t> _connection_count{"gateway_connections"};
 };
 
 }  // namespace huzch
\ No newline at end of file
@@ -5,6 +5,12 @@
 DEFINE_bool(run_mode, true, "程序运行模式: true调试/false发布");
 DEFINE_string(log_file, "", "发布模式下日志文件");
 DEFINE_int32(log_level, 0, "发布模式下日志等级");
+DEFINE_bool(log_async, true, "是否异步写日志");
+DEFINE_int32(log_queue_size, 8192, "异步日志队列容量");
+DEFINE_string(log_overflow, "block", "异步日志队列满时策略: block阻塞/overrun覆盖最旧");
+DEFINE_int32(log_flush_interval, 3, "异步日志定期刷盘间隔(秒)");
+DEFINE_int32(log_field_max, 512, "结构化日志单个字段最大字节数");
+DEFINE_string(trace_file, "", "链路追踪文件，为空时不开启追踪");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "etcd服务器地址");
 DEFINE_string(base_dir, "/service", "服务根目录");
@@ -15,17 +21,43 @@ DEFINE_string(forward_service_name, "/forward_service", "转发服务名");
 DEFINE_string(message_service_name, "/message_service", "消息服务名");
 DEFINE_string(friend_service_name, "/friend_service", "好友服务名");
 
-DEFINE_string(redis_host, "127.0.0.1", "redis服务器地址");
+DEFINE_string(redis_mode, "single", "redis部署模式: single/sentinel/cluster");
+DEFINE_string(redis_host, "127.0.0.1", "redis服务器地址(集群模式下为任一节点)");
 DEFINE_int32(redis_port, 6379, "redis服务器端口");
 DEFINE_int32(redis_db, 0, "redis默认库号");
 DEFINE_bool(redis_keep_alive, true, "redis长连接保活选项");
+DEFINE_string(redis_sentinels, "", "哨兵地址列表(host:port,逗号分隔)");
+DEFINE_string(redis_master_name, "mymaster", "哨兵监控的主库名");
+DEFINE_int32(redis_pool_size, 8, "redis连接池大小");
+DEFINE_int32(redis_wait_timeout, 100, "redis连接池获取连接超时(毫秒)");
+DEFINE_int32(redis_connect_timeout, 100, "redis建连超时(毫秒)");
+DEFINE_int32(redis_socket_timeout, 200, "redis读写超时(毫秒)");
+DEFINE_bool(redis_read_replica, false, "登录会话校验是否读从库");
 
 DEFINE_int32(http_port, 9000, "http服务器端口");
 DEFINE_int32(websocket_port, 9001, "websocket服务器端口");
 
+DEFINE_int32(inbox_max_size, 1000, "单用户离线消息收件箱最大容量");
+DEFINE_int32(inbox_ttl, 604800, "离线消息收件箱过期时间(秒)");
+DEFINE_int32(inbox_batch_size, 100, "重连时每帧推送的离线消息数量");
+
+DEFINE_int32(session_ttl, 90, "登录会话过期时间(秒)，需与用户服务一致");
+DEFINE_int32(session_renew_interval, 30, "长连接心跳与登录会话续期间隔(秒)");
+
+DEFINE_int32(presence_flush_interval, 1000, "好友在线状态变化合并推送周期(毫秒)");
+DEFINE_int32(presence_min_interval, 5000, "同一用户在线状态两次广播最小间隔(毫秒)");
+
 int main(int argc, char* argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
-  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+  huzch::LoggerOptions logger_options;
+  logger_options.async = FLAGS_log_async;
+  logger_options.queue_size = FLAGS_log_queue_size;
+  logger_options.overflow = FLAGS_log_overflow;
+  logger_options.flush_interval = FLAGS_log_flush_interval;
+  logger_options.field_max = FLAGS_log_field_max;
+  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level,
+                     logger_options);
+  huzch::Tracer::init("gateway", FLAGS_trace_file);
 
   huzch::GatewayServerBuilder gsb;
 
@@ -37,12 +69,33 @@ int main(int argc, char* argv[]) {
                             FLAGS_friend_service_name);
 
   // 初始化redis数据库
-  gsb.init_redis_client(FLAGS_redis_host, FLAGS_redis_port, FLAGS_redis_db,
-                        FLAGS_redis_keep_alive);
+  huzch::RedisOptions redis_options;
+  redis_options.mode = FLAGS_redis_mode;
+  redis_options.host = FLAGS_redis_host;
+  redis_options.port = FLAGS_redis_port;
+  redis_options.db = FLAGS_redis_db;
+  redis_options.keep_alive = FLAGS_redis_keep_alive;
+  redis_options.sentinels = FLAGS_redis_sentinels;
+  redis_options.master_name = FLAGS_redis_master_name;
+  redis_options.pool_size = FLAGS_redis_pool_size;
+  redis_options.wait_timeout = FLAGS_redis_wait_timeout;
+  redis_options.connect_timeout = FLAGS_redis_connect_timeout;
+  redis_options.socket_timeout = FLAGS_redis_socket_timeout;
+  redis_options.read_replica = FLAGS_redis_read_replica;
+  gsb.init_redis_client(redis_options);
 
   // 初始化http-websocket服务器
   gsb.init_http_websocket_server(FLAGS_http_port, FLAGS_websocket_port);
 
+  // 初始化离线消息收件箱
+  gsb.init_inbox(FLAGS_inbox_max_size, FLAGS_inbox_ttl, FLAGS_inbox_batch_size);
+
+  // 初始化登录会话续期
+  gsb.init_session(FLAGS_session_ttl, FLAGS_session_renew_interval);
+
+  // 初始化好友在线状态推送
+  gsb.init_presence(FLAGS_presence_flush_interval, FLAGS_presence_min_interval);
+
   auto gateway_server = gsb.build();
   gateway_server->start();
 
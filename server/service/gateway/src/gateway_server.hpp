@@ -1,22 +1,27 @@
 #pragma once
+#include <google/protobuf/io/coded_stream.h>
 
 #include "base.pb.h"
 #include "channel.hpp"
 #include "connection.hpp"
 #include "data_redis.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "file.pb.h"
 #include "forward.pb.h"
 #include "friend.pb.h"
 #include "gateway.pb.h"
 #include "httplib.h"
 #include "message.pb.h"
+#include "metrics.hpp"
 #include "notify.pb.h"
+#include "presence.hpp"
 #include "speech.pb.h"
 #include "user.pb.h"
 
 namespace huzch {
 
+#define METRICS "/metrics"
 #define SPEECH_RECOGNIZE "/service/speech/speech_recognize"
 #define GET_SINGLE_FILE "/service/file/get_single_file"
 #define GET_MULTI_FILE "/service/file/get_multi_file"
@@ -28,6 +33,7 @@ namespace huzch {
 #define PHONE_REGISTER "/service/user/phone_register"
 #define PHONE_LOGIN "/service/user/phone_login"
 #define GET_USER_INFO "/service/user/get_user_info"
+#define GET_PRESENCE "/service/user/get_presence"
 #define USER_SEARCH "/service/user/user_search"
 #define SET_USER_AVATAR "/service/user/set_user_avatar"
 #define SET_USER_NAME "/service/user/set_user_name"
@@ -37,6 +43,7 @@ namespace huzch {
 #define GET_HISTORY_MESSAGE "/service/message/get_history_message"
 #define GET_RECENT_MESSAGE "/service/message/get_recent_message"
 #define MESSAGE_SEARCH "/service/message/message_search"
+#define GET_MESSAGES_SINCE "/service/message/get_messages_since"
 #define GET_FRIEND "/service/friend/get_friend"
 #define FRIEND_REMOVE "/service/friend/friend_remove"
 #define FRIEND_ADD_SEND "/service/friend/friend_add_send"
@@ -54,16 +61,26 @@ class GatewayServer {
 
  public:
   GatewayServer(int http_port, int websocket_port,
-                const std::shared_ptr<sw::redis::Redis>& redis_client,
+                const RedisClient::Ptr& redis_client,
                 const std::string& speech_service_name,
                 const std::string& file_service_name,
                 const std::string& user_service_name,
                 const std::string& forward_service_name,
                 const std::string& message_service_name,
                 const std::string& friend_service_name,
-                const ChannelManager::Ptr& channels)
+                const ChannelManager::Ptr& channels, size_t inbox_max_size,
+                int inbox_ttl, size_t inbox_batch_size, int session_ttl,
+                int renew_interval, int presence_flush_interval,
+                int presence_min_interval)
       : _redis_session(std::make_shared<Session>(redis_client)),
         _redis_status(std::make_shared<Status>(redis_client)),
+        _redis_login(std::make_shared<Login>(
+            redis_client, std::chrono::seconds(session_ttl))),
+        _session_ttl(session_ttl),
+        _renew_interval(renew_interval),
+        _redis_inbox(std::make_shared<Inbox>(
+            redis_client, inbox_max_size, std::chrono::seconds(inbox_ttl))),
+        _inbox_batch_size(inbox_batch_size),
         _speech_service_name(speech_service_name),
         _file_service_name(file_service_name),
         _user_service_name(user_service_name),
@@ -71,7 +88,13 @@ class GatewayServer {
         _message_service_name(message_service_name),
         _friend_service_name(friend_service_name),
         _channels(channels),
-        _connections(std::make_shared<ConnectionManager>()) {
+        _connections(std::make_shared<ConnectionManager>()),
+        _presence(std::make_shared<PresenceManager>(
+            redis_client,
+            std::bind(&GatewayServer::push, this, std::placeholders::_1,
+                      std::placeholders::_2),
+            std::chrono::milliseconds(presence_flush_interval),
+            std::chrono::milliseconds(presence_min_interval))) {
     // 取消打印所有日志
     _websocket_server.set_access_channels(websocketpp::log::alevel::none);
     // 初始化asio框架中的io_service调度器
@@ -86,6 +109,10 @@ class GatewayServer {
     _websocket_server.set_message_handler(std::bind(&GatewayServer::on_message,
                                                     this, std::placeholders::_1,
                                                     std::placeholders::_2));
+    // 设置心跳回应回调函数
+    _websocket_server.set_pong_handler(std::bind(&GatewayServer::on_pong, this,
+                                                 std::placeholders::_1,
+                                                 std::placeholders::_2));
     // 启用地址重用
     _websocket_server.set_reuse_addr(true);
     // 设置endpoint监听端口
@@ -133,6 +160,10 @@ class GatewayServer {
         PHONE_LOGIN,
         (CallBack)std::bind(&GatewayServer::PhoneLogin, this,
                             std::placeholders::_1, std::placeholders::_2));
+    _http_server.Post(
+        GET_PRESENCE,
+        (CallBack)std::bind(&GatewayServer::GetPresence, this,
+                            std::placeholders::_1, std::placeholders::_2));
     _http_server.Post(
         GET_USER_INFO,
         (CallBack)std::bind(&GatewayServer::GetUserInfo, this,
@@ -173,6 +204,10 @@ class GatewayServer {
         MESSAGE_SEARCH,
         (CallBack)std::bind(&GatewayServer::MessageSearch, this,
                             std::placeholders::_1, std::placeholders::_2));
+    _http_server.Post(
+        GET_MESSAGES_SINCE,
+        (CallBack)std::bind(&GatewayServer::GetMessagesSince, this,
+                            std::placeholders::_1, std::placeholders::_2));
     _http_server.Post(
         GET_FRIEND,
         (CallBack)std::bind(&GatewayServer::GetFriend, this,
@@ -206,14 +241,92 @@ class GatewayServer {
         (CallBack)std::bind(&GatewayServer::GetChatSessionMember, this,
                             std::placeholders::_1, std::placeholders::_2));
 
+    // Prometheus 拉取入口，导出本进程全部 bvar
+    _http_server.Get(METRICS, [](const httplib::Request& request,
+                                 httplib::Response& response) {
+      response.set_content(Metrics::prometheus(),
+                           "text/plain; version=0.0.4");
+    });
+    // 每个请求建立根 span，trace id 取请求体中的 request_id，
+    // 客户端未填写时生成，并由 parse_request 补全到请求中；
+    // httplib 在同一线程内完成一次请求的路由、处理与日志回调
+    _http_server.set_pre_routing_handler(
+        [](const httplib::Request& request, httplib::Response& response) {
+          if (Tracer::enabled()) {
+            auto& span = http_span();
+            span = std::make_unique<Span>(request.path,
+                                          peek_request_id(request.body), 0);
+            Span::set_current(span.get());
+          }
+          return httplib::Server::HandlerResponse::Unhandled;
+        });
+    // 请求处理完毕后结束根 span，并按匹配到的路由记录耗时，未匹配的路径不计入
+    _http_server.set_logger(
+        [](const httplib::Request& request, const httplib::Response& response) {
+          auto& span = http_span();
+          if (span) {
+            if (response.status >= 400) {
+              span->fail();
+            }
+            Span::set_current(nullptr);
+            span.reset();
+          }
+
+          if (request.matched_route.empty() ||
+              request.matched_route == METRICS) {
+            return;
+          }
+          auto& metric = Metrics::call("gateway_http_" +
+                                       metric_name(request.matched_route));
+          auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - request.start_time_);
+          metric.record(latency.count(), response.status < 400);
+        });
+
     _http_thread = std::thread(
         [this, http_port]() { _http_server.listen("0.0.0.0", http_port); });
     _http_thread.detach();
+
+    _renew_thread = std::thread(&GatewayServer::renew, this);
+    _renew_thread.detach();
   }
 
   void start() { _websocket_server.run(); }
 
  private:
+  // 反序列化客户端请求，客户端未填写 request_id 时以当前 trace id 补全，
+  // 使下游服务与网关日志使用同一 request_id
+  template <typename Req>
+  static bool parse_request(const std::string& body, Req& req) {
+    if (!req.ParseFromString(body)) {
+      return false;
+    }
+    if (req.request_id().empty()) {
+      req.set_request_id(trace_request_id());
+    }
+    return true;
+  }
+
+  static std::unique_ptr<Span>& http_span() {
+    thread_local std::unique_ptr<Span> span;
+    return span;
+  }
+
+  // 请求体均为首字段是 request_id 的 protobuf 消息，只解析第一个字段
+  static std::string peek_request_id(const std::string& body) {
+    // 字段号1、长度分隔类型的标签：(1 << 3) | 2
+    constexpr uint32_t request_id_tag = 10;
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const uint8_t*>(body.data()), body.size());
+    uint32_t length = 0;
+    std::string request_id;
+    if (input.ReadTag() != request_id_tag || !input.ReadVarint32(&length) ||
+        length > 64 || !input.ReadString(&request_id, length)) {
+      return std::string();
+    }
+    return request_id;
+  }
+
   void on_open(websocketpp::connection_hdl hdl) {
     auto connection = _websocket_server.get_con_from_hdl(hdl);
     LOG_INFO("websocket长连接建立成功 {}", (size_t)connection.get());
@@ -229,18 +342,19 @@ class GatewayServer {
       return;
     }
 
+    // 心跳超时的连接其会话与状态通常已过期，redis 出错也不能跳过下线处理，
+    // 否则连接会残留在连接管理器中，好友也收不到下线通知
     ret = _redis_session->remove(session_id);
     if (!ret) {
       LOG_ERROR("redis移除用户会话失败");
-      return;
     }
 
     ret = _redis_status->remove(user_id);
     if (!ret) {
       LOG_ERROR("redis移除用户状态失败");
-      return;
     }
 
+    _presence->offline(user_id);
     _connections->remove(connection);
     LOG_INFO("websocket长连接断开成功 {}", (size_t)connection.get());
   }
@@ -249,9 +363,10 @@ class GatewayServer {
       websocketpp::connection_hdl hdl,
       websocketpp::server<websocketpp::config::asio>::message_ptr message) {
     auto connection = _websocket_server.get_con_from_hdl(hdl);
+    _connections->touch(connection);
 
     ClientAuthenticationReq req;
-    bool ret = req.ParseFromString(message->get_payload());
+    bool ret = parse_request(message->get_payload(), req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       _websocket_server.close(hdl, websocketpp::close::status::invalid_payload,
@@ -270,6 +385,88 @@ class GatewayServer {
 
     _connections->insert(connection, *user_id, login_session_id);
     LOG_INFO("websocket长连接建立成功 {}", (size_t)connection.get());
+
+    // 好友列表需查询好友服务，以异步rpc获取，不阻塞websocket事件循环
+    fetch_friends_id(req.request_id(), *user_id, connection);
+
+    // 认证通过后，分批推送离线期间积压的消息；先读后删，
+    // 只删除已成功交给连接发送的部分，推送中途断开时剩余消息留待下次重连
+    std::vector<std::string> messages;
+    ret = _redis_inbox->peek(*user_id, messages);
+    if (!ret || messages.empty()) {
+      return;
+    }
+
+    size_t sent = 0;
+    for (size_t i = 0; i < messages.size(); i += _inbox_batch_size) {
+      NotifyMessage notify;
+      notify.set_notify_type(NotifyType::CHAT_MESSAGE_BATCH_NOTIFY);
+      auto batch = notify.mutable_new_message_batch();
+      size_t end = std::min(i + _inbox_batch_size, messages.size());
+      for (size_t j = i; j < end; ++j) {
+        if (!batch->add_messages_info()->ParseFromString(messages[j])) {
+          LOG_ERROR("离线消息反序列化失败");
+          batch->mutable_messages_info()->RemoveLast();
+        }
+      }
+      auto ec = connection->send(notify.SerializeAsString(),
+                                 websocketpp::frame::opcode::value::binary);
+      if (ec) {
+        LOG_WARN("用户 {} 离线消息推送中断: {}", *user_id, ec.message());
+        break;
+      }
+      sent = end;
+    }
+    _redis_inbox->trim(*user_id, sent);
+    LOG_EVENT_LIMITED(info, 100, req.request_id(), "inbox_flushed", "user_id",
+                      *user_id, "count", sent);
+  }
+
+  void push(const std::string& user_id, const NotifyMessage& notify) {
+    auto connection = _connections->get(user_id);
+    if (!connection) {
+      return;
+    }
+    connection->send(notify.SerializeAsString(),
+                     websocketpp::frame::opcode::value::binary);
+  }
+
+  void on_pong(websocketpp::connection_hdl hdl, std::string payload) {
+    _connections->touch(_websocket_server.get_con_from_hdl(hdl));
+  }
+
+  // 登录会话滑动续期：每隔 renew_interval 向所有长连接发送心跳，
+  // 并将最近一个过期周期内有过消息或心跳回应的连接合并为批量 pipeline 续期；
+  // 超过过期时间仍无回应的连接视为已断开，主动关闭并清理其登录会话；
+  // 异常退出的网关遗留的在线状态字段也在这里逐批清理
+  void renew() {
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::seconds(_renew_interval));
+
+      std::vector<ConnectionManager::ConnectionPtr> alive, stale;
+      std::vector<std::pair<std::string, std::string>> clients;
+      _connections->sweep(std::chrono::seconds(_session_ttl), alive, clients,
+                          stale);
+
+      for (const auto& connection : alive) {
+        websocketpp::lib::error_code ec;
+        connection->ping("", ec);
+      }
+      if (!_redis_login->renew(clients)) {
+        LOG_ERROR("{} 个长连接的登录会话续期失败", clients.size());
+      }
+
+      // 轮流清理一部分在线状态桶中的过期字段
+      _redis_status->purge(_purge_cursor, _purge_buckets);
+      _purge_cursor = (_purge_cursor + _purge_buckets) % KeySchema::BUCKETS;
+
+      for (const auto& connection : stale) {
+        LOG_WARN("websocket长连接心跳超时 {}", (size_t)connection.get());
+        websocketpp::lib::error_code ec;
+        connection->close(websocketpp::close::status::going_away, "心跳超时",
+                          ec);
+      }
+    }
   }
 
   void SpeechRecognize(const httplib::Request& request,
@@ -282,7 +479,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -328,7 +525,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -374,7 +571,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -420,7 +617,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -466,7 +663,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -512,7 +709,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -548,7 +745,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -585,7 +782,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -622,7 +819,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -659,7 +856,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -686,6 +883,52 @@ class GatewayServer {
     response.set_content(rsp.SerializeAsString(), "application/protobuf");
   }
 
+  void GetPresence(const httplib::Request& request,
+                   httplib::Response& response) {
+    GetPresenceReq req;
+    GetPresenceRsp rsp;
+    auto err_rsp = [&req, &rsp, &response](const std::string& errmsg) {
+      rsp.set_success(false);
+      rsp.set_errmsg(errmsg);
+      response.set_content(rsp.SerializeAsString(), "application/protobuf");
+    };
+
+    bool ret = parse_request(request.body, req);
+    if (!ret) {
+      LOG_ERROR("请求正文反序列化失败");
+      err_rsp("请求正文反序列化失败");
+      return;
+    }
+
+    std::string login_session_id = req.login_session_id();
+    auto user_id = _redis_session->user_id(login_session_id);
+    if (!user_id) {
+      LOG_ERROR("登录会话不存在");
+      err_rsp("登录会话不存在");
+      return;
+    }
+    req.set_user_id(*user_id);
+
+    auto channel = _channels->get(_user_service_name);
+    if (!channel) {
+      LOG_ERROR("{} 服务节点不存在", _user_service_name);
+      err_rsp("服务节点不存在");
+      return;
+    }
+
+    huzch::UserService_Stub stub(channel.get());
+    brpc::Controller ctrl;
+    stub.GetPresence(&ctrl, &req, &rsp, nullptr);
+    if (ctrl.Failed() || !rsp.success()) {
+      LOG_ERROR("{} {} 服务调用失败: {} {}", req.request_id(),
+                _user_service_name, ctrl.ErrorText(), rsp.errmsg());
+      err_rsp("服务调用失败");
+      return;
+    }
+
+    response.set_content(rsp.SerializeAsString(), "application/protobuf");
+  }
+
   void GetUserInfo(const httplib::Request& request,
                    httplib::Response& response) {
     GetUserInfoReq req;
@@ -696,7 +939,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -742,7 +985,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -788,7 +1031,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -834,7 +1077,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -880,7 +1123,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -926,7 +1169,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -972,7 +1215,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1011,15 +1254,32 @@ class GatewayServer {
     notify.mutable_new_message_info()->mutable_message_info()->CopyFrom(
         rsp.message_info());
 
+    static auto& fanout = Metrics::size("gateway_message_fanout");
+    fanout.record(rsp.targets_id_size());
+
+    // 离线用户与推送失败的连接(正在断开)收集后一次写入收件箱，
+    // 等待重连后同步，避免大群中逐个同步写入redis
+    std::string payload = notify.SerializeAsString();
+    std::vector<std::string> offline;
     for (auto& target_id : rsp.targets_id()) {
       if (target_id == req.user_id()) {
         continue;
       }
       auto connection = _connections->get(target_id);
       if (connection) {
-        connection->send(notify.SerializeAsString(),
-                         websocketpp::frame::opcode::value::binary);
+        auto ec = connection->send(payload,
+                                   websocketpp::frame::opcode::value::binary);
+        if (!ec) {
+          continue;
+        }
+        LOG_WARN("用户 {} 消息推送失败，转入离线收件箱: {}", target_id,
+                 ec.message());
       }
+      offline.push_back(target_id);
+    }
+    if (!_redis_inbox->push(offline, rsp.message_info().SerializeAsString())) {
+      LOG_ERROR("{} {} 个离线用户消息写入收件箱失败", req.request_id(),
+                offline.size());
     }
     rsp.clear_message_info();
     rsp.clear_targets_id();
@@ -1037,7 +1297,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1083,7 +1343,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1119,6 +1379,52 @@ class GatewayServer {
     response.set_content(rsp.SerializeAsString(), "application/protobuf");
   }
 
+  void GetMessagesSince(const httplib::Request& request,
+                        httplib::Response& response) {
+    GetMessagesSinceReq req;
+    GetMessagesSinceRsp rsp;
+    auto err_rsp = [&req, &rsp, &response](const std::string& errmsg) {
+      rsp.set_success(false);
+      rsp.set_errmsg(errmsg);
+      response.set_content(rsp.SerializeAsString(), "application/protobuf");
+    };
+
+    bool ret = parse_request(request.body, req);
+    if (!ret) {
+      LOG_ERROR("请求正文反序列化失败");
+      err_rsp("请求正文反序列化失败");
+      return;
+    }
+
+    std::string login_session_id = req.login_session_id();
+    auto user_id = _redis_session->user_id(login_session_id);
+    if (!user_id) {
+      LOG_ERROR("登录会话不存在");
+      err_rsp("登录会话不存在");
+      return;
+    }
+    req.set_user_id(*user_id);
+
+    auto channel = _channels->get(_message_service_name);
+    if (!channel) {
+      LOG_ERROR("{} 服务节点不存在", _message_service_name);
+      err_rsp("服务节点不存在");
+      return;
+    }
+
+    huzch::MessageService_Stub stub(channel.get());
+    brpc::Controller ctrl;
+    stub.GetMessagesSince(&ctrl, &req, &rsp, nullptr);
+    if (ctrl.Failed() || !rsp.success()) {
+      LOG_ERROR("{} {} 服务调用失败: {} {}", req.request_id(),
+                _message_service_name, ctrl.ErrorText(), rsp.errmsg());
+      err_rsp("服务调用失败");
+      return;
+    }
+
+    response.set_content(rsp.SerializeAsString(), "application/protobuf");
+  }
+
   void MessageSearch(const httplib::Request& request,
                      httplib::Response& response) {
     MessageSearchReq req;
@@ -1129,7 +1435,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1174,7 +1480,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1220,7 +1526,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1277,7 +1583,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1343,7 +1649,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1450,7 +1756,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1496,7 +1802,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1542,7 +1848,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1605,7 +1911,7 @@ class GatewayServer {
       response.set_content(rsp.SerializeAsString(), "application/protobuf");
     };
 
-    bool ret = req.ParseFromString(request.body);
+    bool ret = parse_request(request.body, req);
     if (!ret) {
       LOG_ERROR("请求正文反序列化失败");
       err_rsp("请求正文反序列化失败");
@@ -1641,6 +1947,65 @@ class GatewayServer {
     response.set_content(rsp.SerializeAsString(), "application/protobuf");
   }
 
+  // 上线时的好友列表获取，异步调用期间信道须保持有效，由 fetch 持有
+  struct FriendsFetch {
+    std::string user_id;
+    ConnectionManager::ConnectionPtr connection;
+    ServiceChannel::ChannelPtr channel;
+    brpc::Controller ctrl;
+    GetFriendReq req;
+    GetFriendRsp rsp;
+  };
+
+  void fetch_friends_id(const std::string& request_id,
+                        const std::string& user_id,
+                        const ConnectionManager::ConnectionPtr& connection) {
+    auto fetch = new FriendsFetch;
+    fetch->user_id = user_id;
+    fetch->connection = connection;
+    fetch->channel = _channels->get(_friend_service_name);
+    if (!fetch->channel) {
+      LOG_ERROR("{} 服务节点不存在", _friend_service_name);
+      on_friends_fetched(this, fetch);
+      return;
+    }
+
+    fetch->req.set_request_id(request_id);
+    fetch->req.set_user_id(user_id);
+    fetch->req.set_id_only(true);
+    huzch::FriendService_Stub stub(fetch->channel.get());
+    stub.GetFriend(&fetch->ctrl, &fetch->req, &fetch->rsp,
+                   brpc::NewCallback(&GatewayServer::on_friends_fetched, this,
+                                     fetch));
+  }
+
+  // 获取失败时以空好友列表登记，只是暂不推送好友在线状态；
+  // 登记投递回websocket事件循环线程，与 on_close 串行执行，
+  // 期间连接已断开则不再登记，避免已下线用户被重新标记为在线
+  static void on_friends_fetched(GatewayServer* server, FriendsFetch* fetch) {
+    std::unique_ptr<FriendsFetch> guard(fetch);
+    auto friends_id = std::make_shared<std::vector<std::string>>();
+    if (!fetch->channel || fetch->ctrl.Failed() || !fetch->rsp.success()) {
+      LOG_WARN("{} 用户 {} 好友列表获取失败，暂不推送好友在线状态: {} {}",
+               fetch->req.request_id(), fetch->user_id,
+               fetch->ctrl.ErrorText(), fetch->rsp.errmsg());
+    } else {
+      friends_id->reserve(fetch->rsp.friends_info_size());
+      for (const auto& friend_info : fetch->rsp.friends_info()) {
+        friends_id->push_back(friend_info.user_id());
+      }
+    }
+
+    server->_websocket_server.get_io_service().post(
+        [server, user_id = fetch->user_id, connection = fetch->connection,
+         friends_id]() {
+          if (server->_connections->get(user_id) != connection) {
+            return;
+          }
+          server->_presence->online(user_id, *friends_id);
+        });
+  }
+
   bool get_user(const std::string& request_id, const std::string& user_id,
                 UserInfo& user_info) {
     GetUserInfoReq req;
@@ -1676,6 +2041,13 @@ class GatewayServer {
  private:
   Session::Ptr _redis_session;
   Status::Ptr _redis_status;
+  Login::Ptr _redis_login;
+  int _session_ttl;
+  int _renew_interval;
+  const size_t _purge_buckets = 64;
+  size_t _purge_cursor = 0;
+  Inbox::Ptr _redis_inbox;
+  size_t _inbox_batch_size;
 
   std::string _speech_service_name;
   std::string _file_service_name;
@@ -1686,10 +2058,12 @@ class GatewayServer {
   ChannelManager::Ptr _channels;
 
   ConnectionManager::Ptr _connections;
+  PresenceManager::Ptr _presence;
 
   websocketpp::server<websocketpp::config::asio> _websocket_server;
   httplib::Server _http_server;
   std::thread _http_thread;
+  std::thread _renew_thread;
 };
 
 class GatewayServerBuilder {
@@ -1726,9 +2100,8 @@ class GatewayServerBuilder {
         registry_host, base_dir, put_cb, del_cb);
   }
 
-  void init_redis_client(const std::string& host, int port, int db,
-                         bool keep_alive) {
-    _redis_client = RedisClientFactory::create(host, port, db, keep_alive);
+  void init_redis_client(const RedisOptions& options) {
+    _redis_client = RedisClientFactory::create(options);
   }
 
   void init_http_websocket_server(int http_port, int websocket_port) {
@@ -1736,6 +2109,32 @@ class GatewayServerBuilder {
     _websocket_port = websocket_port;
   }
 
+  void init_inbox(int max_size, int ttl, int batch_size) {
+    if (max_size <= 0 || batch_size <= 0) {
+      LOG_ERROR("离线消息收件箱容量与每帧消息数须大于0: {} {}", max_size,
+                batch_size);
+      abort();
+    }
+    _inbox_max_size = max_size;
+    _inbox_ttl = ttl;
+    _inbox_batch_size = batch_size;
+  }
+
+  void init_session(int ttl, int renew_interval) {
+    if (renew_interval <= 0 || ttl <= renew_interval) {
+      LOG_ERROR("续期间隔须大于0且小于登录会话过期时间: {} {}",
+                renew_interval, ttl);
+      abort();
+    }
+    _session_ttl = ttl;
+    _renew_interval = renew_interval;
+  }
+
+  void init_presence(int flush_interval, int min_interval) {
+    _presence_flush_interval = flush_interval;
+    _presence_min_interval = min_interval;
+  }
+
   GatewayServer::Ptr build() {
     if (!_redis_client) {
       LOG_ERROR("未初始化redis数据库模块");
@@ -1755,15 +2154,24 @@ class GatewayServerBuilder {
     return std::make_shared<GatewayServer>(
         _http_port, _websocket_port, _redis_client, _speech_service_name,
         _file_service_name, _user_service_name, _forward_service_name,
-        _message_service_name, _friend_service_name, _channels);
+        _message_service_name, _friend_service_name, _channels,
+        _inbox_max_size, _inbox_ttl, _inbox_batch_size, _session_ttl,
+        _renew_interval, _presence_flush_interval, _presence_min_interval);
   }
 
  private:
   int _http_port;
   int _websocket_port;
+  size_t _inbox_max_size = 1000;
+  int _inbox_ttl = 604800;
+  size_t _inbox_batch_size = 100;
+  int _session_ttl = 90;
+  int _renew_interval = 30;
+  int _presence_flush_interval = 1000;
+  int _presence_min_interval = 5000;
 
   ServiceDiscovery::Ptr _discovery_client;
-  std::shared_ptr<sw::redis::Redis> _redis_client;
+  RedisClient::Ptr _redis_client;
 
   std::string _speech_service_name;
   std::string _file_service_name;
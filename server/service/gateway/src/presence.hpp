@@ -0,0 +1,192 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "data_redis.hpp"
+#include "logger.hpp"
+#include "metrics.hpp"
+#include "notify.pb.h"
+
+namespace huzch {
+
+// 在线状态变化推送
+// 用户在本网关上线时记录其好友，建立 好友 -> 本网关上关注他的用户 的反向索引；
+// 本网关用户的上下线先暂存，每个合并周期打包发布一次，同一用户两次发布至少间隔
+// min_interval，期间的反复上下线只保留最终状态，频繁断线重连不会放大推送；
+// 各网关收到频道消息后按反向索引找到本地关注者，同样按周期合并为一帧推送
+class PresenceManager {
+ public:
+  using Ptr = std::shared_ptr<PresenceManager>;
+  using PushCallBack =
+      std::function<void(const std::string&, const NotifyMessage&)>;
+
+ public:
+  PresenceManager(const RedisClient::Ptr& redis_client,
+                  const PushCallBack& push,
+                  const std::chrono::milliseconds& flush_interval,
+                  const std::chrono::milliseconds& min_interval)
+      : _redis_presence(std::make_shared<Presence>(redis_client)),
+        _push(push),
+        _flush_interval(flush_interval),
+        _min_interval(min_interval),
+        _subscriber(redis_client, _redis_presence->channel(),
+                    std::bind(&PresenceManager::on_message, this,
+                              std::placeholders::_1),
+                    []() {}),
+        _thread(&PresenceManager::run, this) {}
+
+  ~PresenceManager() {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _cond.notify_all();
+    _thread.join();
+  }
+
+  void online(const std::string& user_id,
+              const std::vector<std::string>& friends_id) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    unwatch(user_id);
+    _friends[user_id] = friends_id;
+    for (const auto& friend_id : friends_id) {
+      _watchers[friend_id].insert(user_id);
+    }
+    _pending[user_id] = true;
+  }
+
+  void offline(const std::string& user_id) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    unwatch(user_id);
+    _friends.erase(user_id);
+    _outbox.erase(user_id);
+    _pending[user_id] = false;
+  }
+
+ private:
+  struct Published {
+    bool online;
+    std::chrono::steady_clock::time_point at;
+  };
+
+  void unwatch(const std::string& user_id) {
+    auto it = _friends.find(user_id);
+    if (it == _friends.end()) {
+      return;
+    }
+    for (const auto& friend_id : it->second) {
+      auto watchers = _watchers.find(friend_id);
+      if (watchers == _watchers.end()) {
+        continue;
+      }
+      watchers->second.erase(user_id);
+      if (watchers->second.empty()) {
+        _watchers.erase(watchers);
+      }
+    }
+  }
+
+  // 其他网关(包括本网关)发布的状态变化，暂存到本地关注者的发件箱
+  void on_message(const std::string& message) {
+    auto changes = Presence::parse(message);
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (const auto& [user_id, online] : changes) {
+      auto it = _watchers.find(user_id);
+      if (it == _watchers.end()) {
+        continue;
+      }
+      for (const auto& watcher : it->second) {
+        _outbox[watcher][user_id] = online;
+      }
+    }
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+      _cond.wait_for(lock, _flush_interval, [this]() { return _stop; });
+      auto changes = collect();
+      auto outbox = std::move(_outbox);
+      _outbox.clear();
+      lock.unlock();
+
+      if (!changes.empty()) {
+        _redis_presence->publish(changes);
+      }
+      if (!outbox.empty()) {
+        _fanout.record(outbox.size());
+      }
+      for (const auto& [watcher, presences] : outbox) {
+        NotifyMessage notify;
+        notify.set_notify_type(NotifyType::PRESENCE_NOTIFY);
+        auto presence = notify.mutable_presence();
+        for (const auto& [user_id, online] : presences) {
+          auto item = presence->add_presences();
+          item->set_user_id(user_id);
+          item->set_online(online);
+        }
+        _push(watcher, notify);
+      }
+      lock.lock();
+    }
+  }
+
+  // 取出可以发布的状态变化，距上次发布不足 min_interval 的留到之后的周期
+  std::vector<std::pair<std::string, bool>> collect() {
+    auto now = std::chrono::steady_clock::now();
+    std::vector<std::pair<std::string, bool>> changes;
+    for (auto it = _pending.begin(); it != _pending.end();) {
+      auto published = _published.find(it->first);
+      if (published != _published.end()) {
+        if (now - published->second.at < _min_interval) {
+          ++it;
+          continue;
+        }
+        if (published->second.online == it->second) {
+          it = _pending.erase(it);
+          continue;
+        }
+      }
+      changes.emplace_back(it->first, it->second);
+      _published[it->first] = {it->second, now};
+      it = _pending.erase(it);
+    }
+
+    // 已下线且过了限流窗口的用户无需再记录
+    for (auto it = _published.begin(); it != _published.end();) {
+      if (!it->second.online && now - it->second.at >= _min_interval &&
+          !_pending.count(it->first)) {
+        it = _published.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return changes;
+  }
+
+ private:
+  Presence::Ptr _redis_presence;
+  PushCallBack _push;
+  std::chrono::milliseconds _flush_interval;
+  std::chrono::milliseconds _min_interval;
+  SizeMetric& _fanout = Metrics::size("gateway_presence_fanout");
+
+  std::mutex _mutex;
+  std::condition_variable _cond;
+  bool _stop = false;
+  std::unordered_map<std::string, std::vector<std::string>> _friends;
+  std::unordered_map<std::string, std::unordered_set<std::string>> _watchers;
+  std::unordered_map<std::string, bool> _pending;
+  std::unordered_map<std::string, Published> _published;
+  std::unordered_map<std::string, std::unordered_map<std::string, bool>>
+      _outbox;
+
+  RedisSubscriber _subscriber;
+  std::thread _thread;
+};
+
+}  // namespace huzch
\ No newline at end of file
@@ -5,6 +5,12 @@
 DEFINE_bool(run_mode, true, "程序运行模式: true调试/false发布");
 DEFINE_string(log_file, "", "发布模式下日志文件");
 DEFINE_int32(log_level, 0, "发布模式下日志等级");
+DEFINE_bool(log_async, true, "是否异步写日志");
+DEFINE_int32(log_queue_size, 8192, "异步日志队列容量");
+DEFINE_string(log_overflow, "block", "异步日志队列满时策略: block阻塞/overrun覆盖最旧");
+DEFINE_int32(log_flush_interval, 3, "异步日志定期刷盘间隔(秒)");
+DEFINE_int32(log_field_max, 512, "结构化日志单个字段最大字节数");
+DEFINE_string(trace_file, "", "链路追踪文件，为空时不开启追踪");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "etcd服务器地址");
 DEFINE_string(base_dir, "/service", "服务根目录");
@@ -17,9 +23,18 @@ DEFINE_string(message_service_host, "127.0.0.1:10005", "消息服务实例访问
 DEFINE_string(mq_host, "127.0.0.1:5672", "rabbitmq服务器地址");
 DEFINE_string(mq_user, "root", "rabbitmq服务器用户名");
 DEFINE_string(mq_passwd, "123456", "rabbitmq服务器密码");
-DEFINE_string(mq_exchange, "msg_exchange", "持久化消息发布交换机名");
-DEFINE_string(mq_queue, "msg_queue", "持久化消息发布队列名");
-DEFINE_string(mq_routing_key, "msg_queue", "持久化消息发布路由键");
+DEFINE_string(mq_exchange, "msg_exchange", "持久化文本消息发布交换机名");
+DEFINE_string(mq_queue, "msg_queue", "持久化文本消息发布队列名");
+DEFINE_string(mq_routing_key, "msg_queue", "持久化文本消息发布路由键");
+DEFINE_int32(mq_prefetch, 64, "文本消息队列未确认消息数量上限");
+DEFINE_int32(mq_workers, 4, "文本消息并行处理线程数");
+DEFINE_string(mq_media_exchange, "media_exchange",
+              "持久化媒体消息发布交换机名");
+DEFINE_string(mq_media_queue, "media_queue", "持久化媒体消息发布队列名");
+DEFINE_string(mq_media_routing_key, "media_queue",
+              "持久化媒体消息发布路由键");
+DEFINE_int32(mq_media_prefetch, 8, "媒体消息队列未确认消息数量上限");
+DEFINE_int32(mq_media_workers, 2, "媒体消息并行处理线程数");
 
 DEFINE_string(es_host, "http://127.0.0.1:9200/", "es搜索引擎服务器地址");
 
@@ -29,15 +44,42 @@ DEFINE_string(mysql_passwd, "123456", "mysql服务器密码");
 DEFINE_string(mysql_db, "huzch", "mysql默认库名");
 DEFINE_string(mysql_charset, "utf8", "mysql客户端字符集");
 DEFINE_int32(mysql_port, 0, "mysql服务器端口");
-DEFINE_int32(mysql_max_connections, 4, "mysql连接池最大连接数量");
+DEFINE_string(mysql_replicas, "",
+              "mysql从库地址列表(host:port,逗号分隔)，为空时读写都走主库");
+DEFINE_int32(mysql_max_replica_lag, 1000,
+             "从库最大复制延迟(ms)，超过后摘除读流量");
+DEFINE_int32(mysql_read_your_writes, 3000, "写入后读主库的时间窗口(ms)");
+DEFINE_string(mysql_shards, "",
+              "会话分片mysql地址列表(逗号分隔分片，每个分片为 主库|从库 的 "
+              "host:port 列表)，为空时不分片");
+DEFINE_int32(mysql_max_connections, 32, "mysql连接池最大连接数量");
+DEFINE_int32(mysql_min_connections, 8, "mysql连接池启动时预热的连接数量");
 
 DEFINE_int32(rpc_port, 10005, "rpc服务器监听端口");
 DEFINE_int32(rpc_timeout, -1, "rpc调用超时时间");
 DEFINE_int32(rpc_threads, 1, "rpc的io线程数");
 
+DEFINE_int32(history_max_count, 1000, "历史消息单次查询最大数量");
+DEFINE_int32(seq_gap_grace, 120,
+             "增量同步遇到序号缺口时等待其持久化的宽限期(秒)，超过后跳过");
+
+DEFINE_string(archive_dir, "/iChat/archive",
+              "冷消息归档目录，多实例部署时须为各实例共享的存储(如NFS)");
+DEFINE_int32(archive_retention_months, 6, "mysql中保留的热数据月数");
+DEFINE_int32(archive_interval, 3600, "归档线程执行间隔(秒)");
+DEFINE_int32(archive_batch_size, 1000, "归档时每批扫描的消息数量");
+
 int main(int argc, char* argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
-  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+  huzch::LoggerOptions logger_options;
+  logger_options.async = FLAGS_log_async;
+  logger_options.queue_size = FLAGS_log_queue_size;
+  logger_options.overflow = FLAGS_log_overflow;
+  logger_options.flush_interval = FLAGS_log_flush_interval;
+  logger_options.field_max = FLAGS_log_field_max;
+  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level,
+                     logger_options);
+  huzch::Tracer::init("message", FLAGS_trace_file);
 
   huzch::MessageServerBuilder msb;
 
@@ -52,19 +94,33 @@ int main(int argc, char* argv[]) {
                             FLAGS_file_service_name, FLAGS_user_service_name);
 
   // 初始化rabbitmq消息队列
-  msb.init_mq_client(FLAGS_mq_user, FLAGS_mq_passwd, FLAGS_mq_host,
-                     FLAGS_mq_exchange, FLAGS_mq_queue, FLAGS_mq_routing_key);
+  msb.init_mq_client(
+      FLAGS_mq_user, FLAGS_mq_passwd, FLAGS_mq_host,
+      {FLAGS_mq_exchange, FLAGS_mq_queue, FLAGS_mq_routing_key},
+      FLAGS_mq_prefetch, FLAGS_mq_workers,
+      {FLAGS_mq_media_exchange, FLAGS_mq_media_queue,
+       FLAGS_mq_media_routing_key},
+      FLAGS_mq_media_prefetch, FLAGS_mq_media_workers);
 
   // 初始化es搜索引擎
   msb.init_es_client({FLAGS_es_host});
 
   // 初始化mysql数据库
   msb.init_mysql_client(FLAGS_mysql_user, FLAGS_mysql_passwd, FLAGS_mysql_db,
-                        FLAGS_mysql_host, FLAGS_mysql_port, FLAGS_mysql_charset,
-                        FLAGS_mysql_max_connections);
+                        FLAGS_mysql_host, FLAGS_mysql_port,
+                        FLAGS_mysql_replicas, FLAGS_mysql_shards,
+                        FLAGS_mysql_charset, FLAGS_mysql_max_connections,
+                        FLAGS_mysql_min_connections,
+                        FLAGS_mysql_max_replica_lag,
+                        FLAGS_mysql_read_your_writes);
+
+  // 初始化冷消息归档
+  msb.init_archive(FLAGS_archive_dir, FLAGS_archive_retention_months,
+                   FLAGS_archive_interval, FLAGS_archive_batch_size);
 
   // 初始化rpc服务器
-  msb.init_rpc_server(FLAGS_rpc_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
+  msb.init_rpc_server(FLAGS_rpc_port, FLAGS_rpc_timeout, FLAGS_rpc_threads,
+                      FLAGS_history_max_count, FLAGS_seq_gap_grace);
 
   auto message_server = msb.build();
   message_server->start();
@@ -3,9 +3,11 @@
 
 #include "base.pb.h"
 #include "channel.hpp"
+#include "data_archive.hpp"
 #include "data_mysql_message.hpp"
 #include "data_search.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "file.pb.h"
 #include "message.pb.h"
 #include "mq.hpp"
@@ -17,12 +19,17 @@ namespace huzch {
 class MessageServiceImpl : public MessageService {
  public:
   MessageServiceImpl(const std::shared_ptr<elasticlient::Client>& es_client,
-                     const std::shared_ptr<odb::core::database>& mysql_client,
+                     const ShardedDatabase::Ptr& mysql_client,
                      const std::string& file_service_name,
                      const std::string& user_service_name,
-                     const ChannelManager::Ptr& channels)
+                     const ChannelManager::Ptr& channels,
+                     size_t history_max_count, int seq_gap_grace,
+                     const MessageArchive::Ptr& archive)
       : _es_message(std::make_shared<ESMessage>(es_client)),
         _mysql_message(std::make_shared<MessageTable>(mysql_client)),
+        _history(std::make_shared<MessageHistory>(_mysql_message, archive)),
+        _history_max_count(history_max_count),
+        _seq_gap_grace(seq_gap_grace),
         _file_service_name(file_service_name),
         _user_service_name(user_service_name),
         _channels(channels) {
@@ -46,88 +53,21 @@ class MessageServiceImpl : public MessageService {
         boost::posix_time::from_time_t(request->start_time());
     boost::posix_time::ptime end_time =
         boost::posix_time::from_time_t(request->end_time());
+    size_t msg_count = _history_max_count;
+    if (request->has_msg_count() && request->msg_count() > 0 &&
+        request->msg_count() < msg_count) {
+      msg_count = request->msg_count();
+    }
 
     auto messages =
-        _mysql_message->range(chat_session_id, start_time, end_time);
+        _history->range(chat_session_id, start_time, end_time, msg_count);
 
-    std::unordered_set<std::string> users_id;
-    for (auto& message : messages) {
-      users_id.insert(message.user_id());
-    }
-    std::unordered_map<std::string, UserInfo> users_info;
-    bool ret = get_user(request_id, users_id, users_info);
-    if (!ret) {
-      LOG_ERROR("{} 批量获取用户信息失败", request_id);
-      err_rsp("批量获取用户信息失败");
-      return;
-    }
-
-    std::unordered_set<std::string> files_id;
-    for (auto& message : messages) {
-      if (!message.file_id().empty()) {
-        files_id.insert(message.file_id());
-      }
-    }
-    std::unordered_map<std::string, std::string> files_data;
-    ret = get_file(request_id, files_id, files_data);
+    bool ret = fill_messages_info(request_id, messages,
+                                  response->mutable_messages_info());
     if (!ret) {
-      LOG_ERROR("{} 批量下载文件失败", request_id);
-      err_rsp("批量下载文件失败");
+      err_rsp("获取消息信息失败");
       return;
     }
-
-    for (auto& message : messages) {
-      auto message_info = response->add_messages_info();
-      message_info->set_message_id(message.message_id());
-      message_info->set_chat_session_id(message.session_id());
-      message_info->set_timestamp(
-          boost::posix_time::to_time_t(message.create_time()));
-      message_info->mutable_sender()->CopyFrom(users_info[message.user_id()]);
-      switch (message.message_type()) {
-        case MessageType::STRING:
-          message_info->mutable_message()->set_message_type(
-              MessageType::STRING);
-          message_info->mutable_message()
-              ->mutable_string_message()
-              ->set_content(message.content());
-          break;
-        case MessageType::SPEECH:
-          message_info->mutable_message()->set_message_type(
-              MessageType::SPEECH);
-          message_info->mutable_message()
-              ->mutable_speech_message()
-              ->set_file_id(message.file_id());
-          message_info->mutable_message()
-              ->mutable_speech_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        case MessageType::IMAGE:
-          message_info->mutable_message()->set_message_type(MessageType::IMAGE);
-          message_info->mutable_message()->mutable_image_message()->set_file_id(
-              message.file_id());
-          message_info->mutable_message()
-              ->mutable_image_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        case MessageType::FILE:
-          message_info->mutable_message()->set_message_type(MessageType::FILE);
-          message_info->mutable_message()->mutable_file_message()->set_file_id(
-              message.file_id());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_size(message.file_size());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_name(message.file_name());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        default:
-          LOG_ERROR("消息类型不合法");
-          return;
-      }
-    }
     response->set_success(true);
   }
 
@@ -146,86 +86,20 @@ class MessageServiceImpl : public MessageService {
     std::string chat_session_id = request->chat_session_id();
     int msg_count = request->msg_count();
 
-    auto messages = _mysql_message->recent(chat_session_id, msg_count);
-
-    std::unordered_set<std::string> users_id;
-    for (auto& message : messages) {
-      users_id.insert(message.user_id());
-    }
-    std::unordered_map<std::string, UserInfo> users_info;
-    bool ret = get_user(request_id, users_id, users_info);
-    if (!ret) {
-      LOG_ERROR("{} 批量获取用户信息失败", request_id);
-      err_rsp("批量获取用户信息失败");
-      return;
+    std::vector<Message> messages;
+    if (request->has_before_message_id()) {
+      messages = _history->before(chat_session_id,
+                                  request->before_message_id(), msg_count);
+    } else {
+      messages = _history->recent(chat_session_id, msg_count);
     }
 
-    std::unordered_set<std::string> files_id;
-    for (auto& message : messages) {
-      if (!message.file_id().empty()) {
-        files_id.insert(message.file_id());
-      }
-    }
-    std::unordered_map<std::string, std::string> files_data;
-    ret = get_file(request_id, files_id, files_data);
+    bool ret = fill_messages_info(request_id, messages,
+                                  response->mutable_messages_info());
     if (!ret) {
-      LOG_ERROR("{} 批量下载文件失败", request_id);
-      err_rsp("批量下载文件失败");
+      err_rsp("获取消息信息失败");
       return;
     }
-
-    for (auto& message : messages) {
-      auto message_info = response->add_messages_info();
-      message_info->set_message_id(message.message_id());
-      message_info->set_chat_session_id(message.session_id());
-      message_info->set_timestamp(
-          boost::posix_time::to_time_t(message.create_time()));
-      message_info->mutable_sender()->CopyFrom(users_info[message.user_id()]);
-      switch (message.message_type()) {
-        case MessageType::STRING:
-          message_info->mutable_message()->set_message_type(
-              MessageType::STRING);
-          message_info->mutable_message()
-              ->mutable_string_message()
-              ->set_content(message.content());
-          break;
-        case MessageType::SPEECH:
-          message_info->mutable_message()->set_message_type(
-              MessageType::SPEECH);
-          message_info->mutable_message()
-              ->mutable_speech_message()
-              ->set_file_id(message.file_id());
-          message_info->mutable_message()
-              ->mutable_speech_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        case MessageType::IMAGE:
-          message_info->mutable_message()->set_message_type(MessageType::IMAGE);
-          message_info->mutable_message()->mutable_image_message()->set_file_id(
-              message.file_id());
-          message_info->mutable_message()
-              ->mutable_image_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        case MessageType::FILE:
-          message_info->mutable_message()->set_message_type(MessageType::FILE);
-          message_info->mutable_message()->mutable_file_message()->set_file_id(
-              message.file_id());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_size(message.file_size());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_name(message.file_name());
-          message_info->mutable_message()
-              ->mutable_file_message()
-              ->set_file_content(files_data[message.file_id()]);
-          break;
-        default:
-          LOG_ERROR("消息类型不合法");
-          return;
-      }
-    }
     response->set_success(true);
   }
 
@@ -272,6 +146,37 @@ class MessageServiceImpl : public MessageService {
     response->set_success(true);
   }
 
+  void GetMessagesSince(google::protobuf::RpcController* controller,
+                        const GetMessagesSinceReq* request,
+                        GetMessagesSinceRsp* response,
+                        google::protobuf::Closure* done) {
+    brpc::ClosureGuard rpc_guard(done);
+    std::string request_id = request->request_id();
+    response->set_request_id(request_id);
+
+    auto err_rsp = [response](const std::string& errmsg) {
+      response->set_success(false);
+      response->set_errmsg(errmsg);
+    };
+    std::string chat_session_id = request->chat_session_id();
+    size_t msg_count = _history_max_count;
+    if (request->msg_count() > 0 && request->msg_count() < msg_count) {
+      msg_count = request->msg_count();
+    }
+
+    auto messages =
+        _history->since(chat_session_id, request->seq(), msg_count);
+    trim_gap(request->seq(), messages, response);
+
+    bool ret = fill_messages_info(request_id, messages,
+                                  response->mutable_messages_info());
+    if (!ret) {
+      err_rsp("获取消息信息失败");
+      return;
+    }
+    response->set_success(true);
+  }
+
   void on_message(const char* body, uint64_t body_size) {
     MessageInfo message_info;
     bool ret = message_info.ParseFromArray(body, body_size);
@@ -295,34 +200,44 @@ class MessageServiceImpl : public MessageService {
           return;
         }
         break;
+      // 转发服务已上传文件时消息只携带文件id，无需再次上传
       case MessageType::SPEECH:
-        ret = put_file(
-            file_id, "",
-            message_info.message().speech_message().file_content().size(),
-            message_info.message().speech_message().file_content());
-        if (!ret) {
-          LOG_ERROR("语音消息存储失败");
-          return;
+        file_id = message_info.message().speech_message().file_id();
+        if (file_id.empty()) {
+          ret = put_file(
+              file_id, "",
+              message_info.message().speech_message().file_content().size(),
+              message_info.message().speech_message().file_content());
+          if (!ret) {
+            LOG_ERROR("语音消息存储失败");
+            return;
+          }
         }
         break;
       case MessageType::IMAGE:
-        ret = put_file(
-            file_id, "",
-            message_info.message().image_message().file_content().size(),
-            message_info.message().image_message().file_content());
-        if (!ret) {
-          LOG_ERROR("图片消息存储失败");
-          return;
+        file_id = message_info.message().image_message().file_id();
+        if (file_id.empty()) {
+          ret = put_file(
+              file_id, "",
+              message_info.message().image_message().file_content().size(),
+              message_info.message().image_message().file_content());
+          if (!ret) {
+            LOG_ERROR("图片消息存储失败");
+            return;
+          }
         }
         break;
       case MessageType::FILE:
+        file_id = message_info.message().file_message().file_id();
         file_name = message_info.message().file_message().file_name();
         file_size = message_info.message().file_message().file_size();
-        ret = put_file(file_id, file_name, file_size,
-                       message_info.message().file_message().file_content());
-        if (!ret) {
-          LOG_ERROR("文件消息存储失败");
-          return;
+        if (file_id.empty()) {
+          ret = put_file(file_id, file_name, file_size,
+                         message_info.message().file_message().file_content());
+          if (!ret) {
+            LOG_ERROR("文件消息存储失败");
+            return;
+          }
         }
         break;
       default:
@@ -338,16 +253,125 @@ class MessageServiceImpl : public MessageService {
     message.file_id(file_id);
     message.file_name(file_name);
     message.file_size(file_size);
+    message.seq(message_info.seq());
     ret = _mysql_message->insert(message);
     if (!ret) {
       LOG_ERROR("mysql新增消息失败");
       return;
     }
 
-    LOG_DEBUG("消息存储完毕");
+    LOG_EVENT_LIMITED(debug, 100, RequestContext::request_id(),
+                      "message_stored", "message_id",
+                      message_info.message_id(), "session_id",
+                      message_info.chat_session_id());
   }
 
  private:
+  // 文本与媒体消息分队列持久化，并发发送也会竞争发布，序号较大的消息可能
+  // 先于较小的写入。只返回游标之后连续的一段，遇到缺口时截断并告知客户端，
+  // 避免客户端游标越过尚未写入的消息；缺口之后的消息已超过宽限期时，
+  // 缺失的序号视为发布失败造成的永久空洞，直接跳过
+  void trim_gap(long long cursor, std::vector<Message>& messages,
+                GetMessagesSinceRsp* response) {
+    auto settled = boost::posix_time::second_clock::universal_time() -
+                   boost::posix_time::seconds(_seq_gap_grace);
+    long long expected = cursor + 1;
+    size_t end = 0;
+    for (; end < messages.size(); ++end) {
+      long long seq = messages[end].seq();
+      if (seq > expected && messages[end].create_time() > settled) {
+        response->set_gap_seq(expected);
+        break;
+      }
+      expected = std::max(expected, seq + 1);
+    }
+    messages.resize(end);
+  }
+
+  // 补全发送者信息与文件数据，将消息转换为MessageInfo
+  bool fill_messages_info(
+      const std::string& request_id, const std::vector<Message>& messages,
+      google::protobuf::RepeatedPtrField<MessageInfo>* messages_info) {
+    std::unordered_set<std::string> users_id;
+    for (const auto& message : messages) {
+      users_id.insert(message.user_id());
+    }
+    std::unordered_map<std::string, UserInfo> users_info;
+    bool ret = get_user(request_id, users_id, users_info);
+    if (!ret) {
+      LOG_ERROR("{} 批量获取用户信息失败", request_id);
+      return false;
+    }
+
+    std::unordered_set<std::string> files_id;
+    for (const auto& message : messages) {
+      if (!message.file_id().empty()) {
+        files_id.insert(message.file_id());
+      }
+    }
+    std::unordered_map<std::string, std::string> files_data;
+    ret = get_file(request_id, files_id, files_data);
+    if (!ret) {
+      LOG_ERROR("{} 批量下载文件失败", request_id);
+      return false;
+    }
+
+    for (const auto& message : messages) {
+      auto message_info = messages_info->Add();
+      message_info->set_message_id(message.message_id());
+      message_info->set_chat_session_id(message.session_id());
+      message_info->set_timestamp(
+          boost::posix_time::to_time_t(message.create_time()));
+      message_info->set_seq(message.seq());
+      message_info->mutable_sender()->CopyFrom(users_info[message.user_id()]);
+      switch (message.message_type()) {
+        case MessageType::STRING:
+          message_info->mutable_message()->set_message_type(
+              MessageType::STRING);
+          message_info->mutable_message()
+              ->mutable_string_message()
+              ->set_content(message.content());
+          break;
+        case MessageType::SPEECH:
+          message_info->mutable_message()->set_message_type(
+              MessageType::SPEECH);
+          message_info->mutable_message()
+              ->mutable_speech_message()
+              ->set_file_id(message.file_id());
+          message_info->mutable_message()
+              ->mutable_speech_message()
+              ->set_file_content(files_data[message.file_id()]);
+          break;
+        case MessageType::IMAGE:
+          message_info->mutable_message()->set_message_type(MessageType::IMAGE);
+          message_info->mutable_message()->mutable_image_message()->set_file_id(
+              message.file_id());
+          message_info->mutable_message()
+              ->mutable_image_message()
+              ->set_file_content(files_data[message.file_id()]);
+          break;
+        case MessageType::FILE:
+          message_info->mutable_message()->set_message_type(MessageType::FILE);
+          message_info->mutable_message()->mutable_file_message()->set_file_id(
+              message.file_id());
+          message_info->mutable_message()
+              ->mutable_file_message()
+              ->set_file_size(message.file_size());
+          message_info->mutable_message()
+              ->mutable_file_message()
+              ->set_file_name(message.file_name());
+          message_info->mutable_message()
+              ->mutable_file_message()
+              ->set_file_content(files_data[message.file_id()]);
+          break;
+        default:
+          LOG_ERROR("{} 消息类型不合法", request_id);
+          return false;
+      }
+    }
+    return true;
+  }
+
   bool get_user(const std::string& request_id,
                 const std::unordered_set<std::string> users_id,
                 std::unordered_map<std::string, UserInfo>& users_info) {
@@ -412,7 +436,8 @@ class MessageServiceImpl : public MessageService {
 
   bool put_file(std::string& file_id, const std::string& file_name,
                 const uint64_t file_size, const std::string& file_content) {
-    std::string request_id = uuid();
+    // 在消息消费过程中调用，沿用发送该消息的请求的 trace id
+    std::string request_id = trace_request_id();
     auto channel = _channels->get(_file_service_name);
     if (!channel) {
       LOG_ERROR("{} 未找到 {} 服务节点", request_id, _file_service_name);
@@ -440,8 +465,11 @@ class MessageServiceImpl : public MessageService {
   }
 
  private:
-  MessageTable::Ptr _mysql_message;
   ESMessage::Ptr _es_message;
+  MessageTable::Ptr _mysql_message;
+  MessageHistory::Ptr _history;
+  size_t _history_max_count;
+  int _seq_gap_grace;  // 序号缺口的等待宽限期(秒)
 
   std::string _file_service_name;
   std::string _user_service_name;
@@ -453,14 +481,16 @@ class MessageServer {
   using Ptr = std::shared_ptr<MessageServer>;
 
  public:
-  MessageServer(const std::shared_ptr<brpc::Server>& server)
-      : _server(server) {}
+  MessageServer(const std::shared_ptr<brpc::Server>& server,
+                const MessageArchiver::Ptr& archiver)
+      : _server(server), _archiver(archiver) {}
 
   // 启动服务器
   void start() { _server->RunUntilAskedToQuit(); }
 
  private:
   std::shared_ptr<brpc::Server> _server;
+  MessageArchiver::Ptr _archiver;
 };
 
 class MessageServerBuilder {
@@ -491,12 +521,17 @@ class MessageServerBuilder {
         registry_host, base_dir, put_cb, del_cb);
   }
 
+  // 文本与媒体消息分队列消费，各自拥有独立的信道与工作线程
   void init_mq_client(const std::string& user, const std::string& passwd,
-                      const std::string& host, const std::string& exchange,
-                      const std::string& queue, const std::string& routing_key) {
-    _queue_name = queue;
+                      const std::string& host, const MQBinding& text_binding,
+                      int text_prefetch, int text_workers,
+                      const MQBinding& media_binding, int media_prefetch,
+                      int media_workers) {
+    _text_queue = {text_binding.queue, text_prefetch, text_workers};
+    _media_queue = {media_binding.queue, media_prefetch, media_workers};
     _mq_client = std::make_shared<MQClient>(user, passwd, host);
-    _mq_client->declare(exchange, queue, routing_key);
+    _mq_client->declare(text_binding);
+    _mq_client->declare(media_binding);
   }
 
   void init_es_client(const std::vector<std::string>& hosts) {
@@ -505,13 +540,30 @@ class MessageServerBuilder {
 
   void init_mysql_client(const std::string& user, const std::string& passwd,
                          const std::string& db, const std::string& host,
-                         size_t port, const std::string& charset,
-                         size_t max_connections) {
-    _mysql_client = MysqlClientFactory::create(user, passwd, db, host, port,
-                                               charset, max_connections);
+                         size_t port, const std::string& replica_hosts,
+                         const std::string& shard_hosts,
+                         const std::string& charset, size_t max_connections,
+                         size_t min_connections, int max_lag, int ryw_window) {
+    _mysql_client = ShardedDatabaseFactory::create(
+        user, passwd, db, host, port, replica_hosts, shard_hosts, charset,
+        max_connections, min_connections, max_lag, ryw_window);
+  }
+
+  void init_archive(const std::string& archive_dir, int retention_months,
+                    int interval, size_t batch_size) {
+    if (!_mysql_client) {
+      LOG_ERROR("未初始化mysql数据库模块");
+      abort();
+    }
+
+    _archive = std::make_shared<MessageArchive>(archive_dir);
+    _archiver = std::make_shared<MessageArchiver>(
+        std::make_shared<MessageTable>(_mysql_client), _archive,
+        retention_months, interval, batch_size);
   }
 
-  void init_rpc_server(int port, int timeout, int num_threads) {
+  void init_rpc_server(int port, int timeout, int num_threads,
+                       size_t history_max_count, int seq_gap_grace) {
     if (!_mq_client) {
       LOG_ERROR("未初始化rabbitmq消息队列模块");
       abort();
@@ -527,11 +579,22 @@ class MessageServerBuilder {
       abort();
     }
 
+    if (!_archive) {
+      LOG_ERROR("未初始化消息归档模块");
+      abort();
+    }
+
+    if (seq_gap_grace <= 0) {
+      LOG_ERROR("消息序号缺口宽限期须大于0: {}", seq_gap_grace);
+      abort();
+    }
+
     _server = std::make_shared<brpc::Server>();
     auto message_service =
         new MessageServiceImpl(_es_client, _mysql_client, _file_service_name,
-                               _user_service_name, _channels);
-    int ret = _server->AddService(message_service,
+                               _user_service_name, _channels,
+                               history_max_count, seq_gap_grace, _archive);
+    int ret = _server->AddService(new TracedService(message_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
@@ -549,7 +612,9 @@ class MessageServerBuilder {
 
     auto msg_cb = std::bind(&MessageServiceImpl::on_message, message_service,
                             std::placeholders::_1, std::placeholders::_2);
-    _mq_client->consume(_queue_name, msg_cb);
+    for (auto& queue : {_text_queue, _media_queue}) {
+      _mq_client->consume(queue.name, msg_cb, queue.prefetch, queue.workers);
+    }
   }
 
   MessageServer::Ptr build() {
@@ -573,16 +638,24 @@ class MessageServerBuilder {
       abort();
     }
 
-    return std::make_shared<MessageServer>(_server);
+    return std::make_shared<MessageServer>(_server, _archiver);
   }
 
  private:
   ServiceRegistry::Ptr _registry_client;
   ServiceDiscovery::Ptr _discovery_client;
-  std::string _queue_name;
+  struct ConsumeQueue {
+    std::string name;
+    int prefetch;
+    int workers;
+  };
+  ConsumeQueue _text_queue;
+  ConsumeQueue _media_queue;
   MQClient::Ptr _mq_client;
   std::shared_ptr<elasticlient::Client> _es_client;
-  std::shared_ptr<odb::core::database> _mysql_client;
+  ShardedDatabase::Ptr _mysql_client;
+  MessageArchive::Ptr _archive;
+  MessageArchiver::Ptr _archiver;
   std::shared_ptr<brpc::Server> _server;
 
   std::string _file_service_name;
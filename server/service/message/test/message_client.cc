@@ -21,6 +21,8 @@ std::string chat_session_id;
 int start_time;
 int end_time;
 int msg_count;
+std::string before_message_id;
+int64_t since_seq;
 std::string search_key;
 
 TEST(get_test, history_message) {
@@ -116,6 +118,59 @@ TEST(get_test, recent_message) {
   }
 }
 
+TEST(get_test, recent_message_before) {
+  huzch::MessageService_Stub stub(channel.get());
+  brpc::Controller ctrl;
+  huzch::GetRecentMessageReq req;
+  req.set_request_id(huzch::uuid());
+  req.set_chat_session_id(chat_session_id);
+  req.set_msg_count(msg_count);
+  req.set_before_message_id(before_message_id);
+  huzch::GetRecentMessageRsp rsp;
+
+  stub.GetRecentMessage(&ctrl, &req, &rsp, nullptr);
+  ASSERT_FALSE(ctrl.Failed());
+  ASSERT_TRUE(rsp.success());
+  ASSERT_LE(rsp.messages_info_size(), msg_count);
+
+  for (const auto& message_info : rsp.messages_info()) {
+    ASSERT_NE(message_info.message_id(), before_message_id);
+    std::cout << message_info.message_id() << std::endl;
+    std::cout << boost::posix_time::to_simple_string(
+                     boost::posix_time::from_time_t(message_info.timestamp()))
+              << std::endl;
+  }
+}
+
+TEST(get_test, messages_since) {
+  huzch::MessageService_Stub stub(channel.get());
+  brpc::Controller ctrl;
+  huzch::GetMessagesSinceReq req;
+  req.set_request_id(huzch::uuid());
+  req.set_chat_session_id(chat_session_id);
+  req.set_seq(since_seq);
+  req.set_msg_count(msg_count);
+  huzch::GetMessagesSinceRsp rsp;
+
+  stub.GetMessagesSince(&ctrl, &req, &rsp, nullptr);
+  ASSERT_FALSE(ctrl.Failed());
+  ASSERT_TRUE(rsp.success());
+  ASSERT_LE(rsp.messages_info_size(), msg_count);
+
+  // 返回的消息序号严格递增且大于请求序号
+  int64_t last_seq = since_seq;
+  for (const auto& message_info : rsp.messages_info()) {
+    ASSERT_GT(message_info.seq(), last_seq);
+    last_seq = message_info.seq();
+    std::cout << message_info.seq() << " " << message_info.message_id()
+              << std::endl;
+  }
+  // 存在缺口时返回的消息止于缺口之前
+  if (rsp.has_gap_seq()) {
+    ASSERT_EQ(rsp.gap_seq(), last_seq + 1);
+  }
+}
+
 TEST(get_test, search_message) {
   huzch::MessageService_Stub stub(channel.get());
   brpc::Controller ctrl;
@@ -171,6 +226,8 @@ int main(int argc, char* argv[]) {
   end_time = boost::posix_time::to_time_t(
       boost::posix_time::time_from_string("2025-09-22 06:25:16"));
   msg_count = 2;
+  before_message_id = "m3";
+  since_seq = 1;
   search_key = "你";
 
   return RUN_ALL_TESTS();
@@ -3,6 +3,7 @@
 
 #include "asr.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "speech.pb.h"
 
 namespace huzch {
@@ -73,7 +74,7 @@ class SpeechServerBuilder {
 
     _server = std::make_shared<brpc::Server>();
     auto speech_service = new SpeechServiceImpl(_asr_client);
-    int ret = _server->AddService(speech_service,
+    int ret = _server->AddService(new TracedService(speech_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
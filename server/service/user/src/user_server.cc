@@ -5,6 +5,12 @@
 DEFINE_bool(run_mode, true, "程序运行模式: true调试/false发布");
 DEFINE_string(log_file, "", "发布模式下日志文件");
 DEFINE_int32(log_level, 0, "发布模式下日志等级");
+DEFINE_bool(log_async, true, "是否异步写日志");
+DEFINE_int32(log_queue_size, 8192, "异步日志队列容量");
+DEFINE_string(log_overflow, "block", "异步日志队列满时策略: block阻塞/overrun覆盖最旧");
+DEFINE_int32(log_flush_interval, 3, "异步日志定期刷盘间隔(秒)");
+DEFINE_int32(log_field_max, 512, "结构化日志单个字段最大字节数");
+DEFINE_string(trace_file, "", "链路追踪文件，为空时不开启追踪");
 
 DEFINE_string(registry_host, "http://127.0.0.1:2379", "etcd服务器地址");
 DEFINE_string(base_dir, "/service", "服务根目录");
@@ -23,12 +29,29 @@ DEFINE_string(mysql_passwd, "123456", "mysql服务器密码");
 DEFINE_string(mysql_db, "huzch", "mysql默认库名");
 DEFINE_string(mysql_charset, "utf8", "mysql客户端字符集");
 DEFINE_int32(mysql_port, 0, "mysql服务器端口");
-DEFINE_int32(mysql_max_connections, 4, "mysql连接池最大连接数量");
-
-DEFINE_string(redis_host, "127.0.0.1", "redis服务器地址");
+DEFINE_string(mysql_replicas, "",
+              "mysql从库地址列表(host:port,逗号分隔)，为空时读写都走主库");
+DEFINE_int32(mysql_max_replica_lag, 1000,
+             "从库最大复制延迟(ms)，超过后摘除读流量");
+DEFINE_int32(mysql_read_your_writes, 3000, "写入后读主库的时间窗口(ms)");
+DEFINE_int32(mysql_max_connections, 32, "mysql连接池最大连接数量");
+DEFINE_int32(mysql_min_connections, 8, "mysql连接池启动时预热的连接数量");
+
+DEFINE_string(redis_mode, "single", "redis部署模式: single/sentinel/cluster");
+DEFINE_string(redis_host, "127.0.0.1", "redis服务器地址(集群模式下为任一节点)");
 DEFINE_int32(redis_port, 6379, "redis服务器端口");
 DEFINE_int32(redis_db, 0, "redis默认库号");
 DEFINE_bool(redis_keep_alive, true, "redis长连接保活选项");
+DEFINE_string(redis_sentinels, "", "哨兵地址列表(host:port,逗号分隔)");
+DEFINE_string(redis_master_name, "mymaster", "哨兵监控的主库名");
+DEFINE_int32(redis_pool_size, 8, "redis连接池大小");
+DEFINE_int32(redis_wait_timeout, 100, "redis连接池获取连接超时(毫秒)");
+DEFINE_int32(redis_connect_timeout, 100, "redis建连超时(毫秒)");
+DEFINE_int32(redis_socket_timeout, 200, "redis读写超时(毫秒)");
+DEFINE_bool(redis_read_replica, false, "登录会话校验是否读从库");
+DEFINE_int32(session_ttl, 90, "登录会话过期时间(秒)，由网关按心跳续期");
+
+DEFINE_int32(profile_cache_capacity, 10000, "本地缓存的用户资料版本数量上限");
 
 DEFINE_int32(rpc_port, 10003, "rpc服务器监听端口");
 DEFINE_int32(rpc_timeout, -1, "rpc调用超时时间");
@@ -36,7 +59,15 @@ DEFINE_int32(rpc_threads, 1, "rpc的io线程数");
 
 int main(int argc, char* argv[]) {
   google::ParseCommandLineFlags(&argc, &argv, true);
-  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+  huzch::LoggerOptions logger_options;
+  logger_options.async = FLAGS_log_async;
+  logger_options.queue_size = FLAGS_log_queue_size;
+  logger_options.overflow = FLAGS_log_overflow;
+  logger_options.flush_interval = FLAGS_log_flush_interval;
+  logger_options.field_max = FLAGS_log_field_max;
+  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level,
+                     logger_options);
+  huzch::Tracer::init("user", FLAGS_trace_file);
 
   huzch::UserServerBuilder usb;
 
@@ -58,12 +89,34 @@ int main(int argc, char* argv[]) {
 
   // 初始化mysql数据库
   usb.init_mysql_client(FLAGS_mysql_user, FLAGS_mysql_passwd, FLAGS_mysql_db,
-                        FLAGS_mysql_host, FLAGS_mysql_port, FLAGS_mysql_charset,
-                        FLAGS_mysql_max_connections);
+                        FLAGS_mysql_host, FLAGS_mysql_port,
+                        FLAGS_mysql_replicas, FLAGS_mysql_charset,
+                        FLAGS_mysql_max_connections,
+                        FLAGS_mysql_min_connections,
+                        FLAGS_mysql_max_replica_lag,
+                        FLAGS_mysql_read_your_writes);
 
   // 初始化redis数据库
-  usb.init_redis_client(FLAGS_redis_host, FLAGS_redis_port, FLAGS_redis_db,
-                        FLAGS_redis_keep_alive);
+  huzch::RedisOptions redis_options;
+  redis_options.mode = FLAGS_redis_mode;
+  redis_options.host = FLAGS_redis_host;
+  redis_options.port = FLAGS_redis_port;
+  redis_options.db = FLAGS_redis_db;
+  redis_options.keep_alive = FLAGS_redis_keep_alive;
+  redis_options.sentinels = FLAGS_redis_sentinels;
+  redis_options.master_name = FLAGS_redis_master_name;
+  redis_options.pool_size = FLAGS_redis_pool_size;
+  redis_options.wait_timeout = FLAGS_redis_wait_timeout;
+  redis_options.connect_timeout = FLAGS_redis_connect_timeout;
+  redis_options.socket_timeout = FLAGS_redis_socket_timeout;
+  redis_options.read_replica = FLAGS_redis_read_replica;
+  usb.init_redis_client(redis_options);
+
+  // 初始化登录会话
+  usb.init_session(FLAGS_session_ttl);
+
+  // 初始化用户资料版本缓存
+  usb.init_profile_cache(FLAGS_profile_cache_capacity);
 
   // 初始化rpc服务器
   usb.init_rpc_server(FLAGS_rpc_port, FLAGS_rpc_timeout, FLAGS_rpc_threads);
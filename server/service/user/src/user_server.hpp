@@ -3,10 +3,13 @@
 
 #include "base.pb.h"
 #include "channel.hpp"
+#include "data_mysql_relation.hpp"
 #include "data_mysql_user.hpp"
 #include "data_redis.hpp"
 #include "data_search.hpp"
+#include "profile_cache.hpp"
 #include "registry.hpp"
+#include "trace.hpp"
 #include "file.pb.h"
 #include "sms.hpp"
 #include "user.pb.h"
@@ -17,16 +20,21 @@ namespace huzch {
 class UserServiceImpl : public UserService {
  public:
   UserServiceImpl(const std::shared_ptr<elasticlient::Client>& es_client,
-                  const std::shared_ptr<odb::core::database>& mysql_client,
-                  const std::shared_ptr<sw::redis::Redis>& redis_client,
-                  const SMSClient::Ptr& sms_client,
+                  const ReplicatedDatabase::Ptr& mysql_client,
+                  const RedisClient::Ptr& redis_client,
+                  const ProfileCache::Ptr& profile_cache,
+                  int session_ttl, const SMSClient::Ptr& sms_client,
                   const std::string& file_service_name,
                   const ChannelManager::Ptr& channels)
       : _es_user(std::make_shared<ESUser>(es_client)),
         _mysql_user(std::make_shared<UserTable>(mysql_client)),
-        _redis_session(std::make_shared<Session>(redis_client)),
-        _redis_status(std::make_shared<Status>(redis_client)),
+        _mysql_relation(std::make_shared<RelationTable>(mysql_client)),
+        _redis_login(std::make_shared<Login>(
+            redis_client, std::chrono::seconds(session_ttl))),
         _redis_code(std::make_shared<Code>(redis_client)),
+        _redis_presence(std::make_shared<Presence>(redis_client)),
+        _redis_profile(std::make_shared<ProfileVersion>(redis_client)),
+        _profile_cache(profile_cache),
         _sms_client(sms_client),
         _file_service_name(file_service_name),
         _channels(channels) {
@@ -106,28 +114,20 @@ class UserServiceImpl : public UserService {
       return;
     }
 
-    bool ret = _redis_status->exists(user->user_id());
-    if (ret) {
+    std::string login_session_id =
+        KeySchema::session_id(user->user_id(), secure_token());
+    int ret = _redis_login->login(user->user_id(), login_session_id);
+    if (ret == 0) {
       LOG_ERROR("{} 用户已在其他地方登录: {}", request_id, name);
       err_rsp("用户已在其他地方登录");
       return;
     }
-
-    std::string login_session_id = uuid();
-    ret = _redis_session->insert(login_session_id, user->user_id());
-    if (!ret) {
+    if (ret < 0) {
       LOG_ERROR("{} redis新增用户会话失败", request_id);
       err_rsp("redis新增用户会话失败");
       return;
     }
 
-    ret = _redis_status->insert(user->user_id());
-    if (!ret) {
-      LOG_ERROR("{} redis新增用户状态失败", request_id);
-      err_rsp("redis新增用户状态失败");
-      return;
-    }
-
     response->set_success(true);
     response->set_login_session_id(login_session_id);
   }
@@ -152,7 +152,7 @@ class UserServiceImpl : public UserService {
       return;
     }
 
-    std::string code_id = uuid();
+    std::string code_id = secure_token();
     std::string code = verify_code();
     bool ret = _sms_client->send(phone, code);
     if (!ret) {
@@ -264,28 +264,20 @@ class UserServiceImpl : public UserService {
     }
     _redis_code->remove(code_id);
 
-    bool ret = _redis_status->exists(user->user_id());
-    if (ret) {
+    std::string login_session_id =
+        KeySchema::session_id(user->user_id(), secure_token());
+    int ret = _redis_login->login(user->user_id(), login_session_id);
+    if (ret == 0) {
       LOG_ERROR("{} 用户已在其他地方登录: {}", request_id, phone);
       err_rsp("用户已在其他地方登录");
       return;
     }
-
-    std::string login_session_id = uuid();
-    ret = _redis_session->insert(login_session_id, user->user_id());
-    if (!ret) {
+    if (ret < 0) {
       LOG_ERROR("{} redis新增用户会话失败", request_id);
       err_rsp("redis新增用户会话失败");
       return;
     }
 
-    ret = _redis_status->insert(user->user_id());
-    if (!ret) {
-      LOG_ERROR("{} redis新增用户状态失败", request_id);
-      err_rsp("redis新增用户状态失败");
-      return;
-    }
-
     response->set_success(true);
     response->set_login_session_id(login_session_id);
   }
@@ -303,7 +295,16 @@ class UserServiceImpl : public UserService {
     };
     std::string user_id = request->user_id();
 
-    auto user = _mysql_user->select_by_id(user_id);
+    // 先读版本再从主库读资料，并发修改时返回的版本只会偏旧，缓存方据此拒绝
+    // 回填；从库的复制延迟可能使旧资料带上新版本，被缓存长期保留
+    long long version = _profile_cache->version(user_id);
+    if (version < 0) {
+      LOG_ERROR("{} 获取用户资料版本失败: {}", request_id, user_id);
+      err_rsp("获取用户资料版本失败");
+      return;
+    }
+
+    auto user = _mysql_user->select_by_id(user_id, true);
     if (!user) {
       LOG_ERROR("{} 用户不存在: {}", request_id, user_id);
       err_rsp("用户不存在");
@@ -314,6 +315,7 @@ class UserServiceImpl : public UserService {
     response->mutable_user_info()->set_name(user->name());
     response->mutable_user_info()->set_phone(user->phone());
     response->mutable_user_info()->set_description(user->description());
+    response->mutable_user_info()->set_profile_version(version);
     if (!user->avatar_id().empty()) {
       auto channel = _channels->get(_file_service_name);
       if (!channel) {
@@ -362,7 +364,16 @@ class UserServiceImpl : public UserService {
       users_id.push_back(request->users_id(i));
     }
 
-    auto users = _mysql_user->select_by_multi_id(users_id);
+    // 与 GetUserInfo 相同，先读版本再从主库读资料，避免从库的旧资料
+    // 带上新版本被缓存长期保留
+    std::unordered_map<std::string, long long> versions;
+    if (!_profile_cache->versions(users_id, versions)) {
+      LOG_ERROR("{} 批量获取用户资料版本失败", request_id);
+      err_rsp("批量获取用户资料版本失败");
+      return;
+    }
+
+    auto users = _mysql_user->select_by_multi_id(users_id, true);
     if (users.size() != users_id.size()) {
       LOG_ERROR("{} 用户查询结果与查找条件不一致 {} {}", request_id,
                 users.size(), users_id.size());
@@ -390,6 +401,7 @@ class UserServiceImpl : public UserService {
       user_info.set_name(user.name());
       user_info.set_phone(user.phone());
       user_info.set_description(user.description());
+      user_info.set_profile_version(versions[user.user_id()]);
       if (!user.avatar_id().empty()) {
         user_info.set_avatar(files_data[user.avatar_id()]);
       }
@@ -398,6 +410,48 @@ class UserServiceImpl : public UserService {
     response->set_success(true);
   }
 
+  void GetPresence(google::protobuf::RpcController* controller,
+                   const GetPresenceReq* request, GetPresenceRsp* response,
+                   google::protobuf::Closure* done) {
+    brpc::ClosureGuard rpc_guard(done);
+    std::string request_id = request->request_id();
+    response->set_request_id(request_id);
+
+    auto err_rsp = [response](const std::string& errmsg) {
+      response->set_success(false);
+      response->set_errmsg(errmsg);
+    };
+
+    if (request->users_id_size() > _presence_max_batch) {
+      LOG_ERROR("{} 在线状态查询数量超出上限: {}", request_id,
+                request->users_id_size());
+      err_rsp("在线状态查询数量超出上限");
+      return;
+    }
+
+    // 只能查询自己与好友的在线状态，其余id不予返回
+    std::string user_id = request->user_id();
+    auto friends_id = _mysql_relation->friends_id(user_id);
+    std::unordered_set<std::string> allowed(friends_id.begin(),
+                                            friends_id.end());
+    allowed.insert(user_id);
+    std::vector<std::string> users_id;
+    for (const auto& id : request->users_id()) {
+      if (allowed.count(id)) {
+        users_id.push_back(id);
+      }
+    }
+    std::unordered_map<std::string, bool> presence;
+    if (!_redis_presence->query(users_id, presence)) {
+      LOG_ERROR("{} 批量查询在线状态失败", request_id);
+      err_rsp("批量查询在线状态失败");
+      return;
+    }
+
+    response->mutable_presence()->insert(presence.begin(), presence.end());
+    response->set_success(true);
+  }
+
   void UserSearch(google::protobuf::RpcController* controller,
                   const UserSearchReq* request, UserSearchRsp* response,
                   google::protobuf::Closure* done) {
@@ -505,6 +559,12 @@ class UserServiceImpl : public UserService {
       return;
     }
 
+    if (_redis_profile->bump(user_id) < 0) {
+      LOG_ERROR("{} 更新用户资料版本失败: {}", request_id, user_id);
+      err_rsp("更新用户资料版本失败");
+      return;
+    }
+
     response->set_success(true);
   }
 
@@ -551,6 +611,12 @@ class UserServiceImpl : public UserService {
       return;
     }
 
+    if (_redis_profile->bump(user_id) < 0) {
+      LOG_ERROR("{} 更新用户资料版本失败: {}", request_id, user_id);
+      err_rsp("更新用户资料版本失败");
+      return;
+    }
+
     response->set_success(true);
   }
 
@@ -593,6 +659,12 @@ class UserServiceImpl : public UserService {
       return;
     }
 
+    if (_redis_profile->bump(user_id) < 0) {
+      LOG_ERROR("{} 更新用户资料版本失败: {}", request_id, user_id);
+      err_rsp("更新用户资料版本失败");
+      return;
+    }
+
     response->set_success(true);
   }
 
@@ -650,6 +722,12 @@ class UserServiceImpl : public UserService {
       return;
     }
 
+    if (_redis_profile->bump(user_id) < 0) {
+      LOG_ERROR("{} 更新用户资料版本失败: {}", request_id, user_id);
+      err_rsp("更新用户资料版本失败");
+      return;
+    }
+
     response->set_success(true);
   }
 
@@ -747,9 +825,13 @@ class UserServiceImpl : public UserService {
  private:
   ESUser::Ptr _es_user;
   UserTable::Ptr _mysql_user;
-  Session::Ptr _redis_session;
-  Status::Ptr _redis_status;
+  RelationTable::Ptr _mysql_relation;
+  Login::Ptr _redis_login;
   Code::Ptr _redis_code;
+  Presence::Ptr _redis_presence;
+  ProfileVersion::Ptr _redis_profile;
+  ProfileCache::Ptr _profile_cache;  // 只用于缓存资料版本
+  const int _presence_max_batch = 1000;
 
   SMSClient::Ptr _sms_client;
   std::string _file_service_name;
@@ -805,15 +887,27 @@ class UserServerBuilder {
 
   void init_mysql_client(const std::string& user, const std::string& passwd,
                          const std::string& db, const std::string& host,
-                         size_t port, const std::string& charset,
-                         size_t max_connections) {
-    _mysql_client = MysqlClientFactory::create(user, passwd, db, host, port,
-                                               charset, max_connections);
+                         size_t port, const std::string& replica_hosts,
+                         const std::string& charset, size_t max_connections,
+                         size_t min_connections, int max_lag, int ryw_window) {
+    _mysql_client = ReplicatedDatabaseFactory::create(
+        user, passwd, db, host, port, replica_hosts, charset, max_connections,
+        min_connections, max_lag, ryw_window);
+  }
+
+  void init_redis_client(const RedisOptions& options) {
+    _redis_client = RedisClientFactory::create(options);
   }
 
-  void init_redis_client(const std::string& host, int port, int db,
-                         bool keep_alive) {
-    _redis_client = RedisClientFactory::create(host, port, db, keep_alive);
+  void init_session(int ttl) { _session_ttl = ttl; }
+
+  void init_profile_cache(size_t capacity) {
+    if (!_redis_client) {
+      LOG_ERROR("未初始化redis数据库模块");
+      abort();
+    }
+
+    _profile_cache = std::make_shared<ProfileCache>(_redis_client, capacity);
   }
 
   void init_rpc_server(int port, int timeout, int num_threads) {
@@ -837,11 +931,16 @@ class UserServerBuilder {
       abort();
     }
 
+    if (!_profile_cache) {
+      LOG_ERROR("未初始化用户资料缓存模块");
+      abort();
+    }
+
     _server = std::make_shared<brpc::Server>();
-    auto user_service =
-        new UserServiceImpl(_es_client, _mysql_client, _redis_client,
-                            _sms_client, _file_service_name, _channels);
-    int ret = _server->AddService(user_service,
+    auto user_service = new UserServiceImpl(
+        _es_client, _mysql_client, _redis_client, _profile_cache, _session_ttl,
+        _sms_client, _file_service_name, _channels);
+    int ret = _server->AddService(new TracedService(user_service),
                                   brpc::ServiceOwnership::SERVER_OWNS_SERVICE);
     if (ret == -1) {
       LOG_ERROR("服务添加失败");
@@ -887,8 +986,10 @@ class UserServerBuilder {
   ServiceDiscovery::Ptr _discovery_client;
   SMSClient::Ptr _sms_client;
   std::shared_ptr<elasticlient::Client> _es_client;
-  std::shared_ptr<odb::core::database> _mysql_client;
-  std::shared_ptr<sw::redis::Redis> _redis_client;
+  ReplicatedDatabase::Ptr _mysql_client;
+  RedisClient::Ptr _redis_client;
+  ProfileCache::Ptr _profile_cache;
+  int _session_ttl = 90;
   std::shared_ptr<brpc::Server> _server;
 
   std::string _file_service_name;
@@ -139,6 +139,30 @@ TEST(search_test, search_user_info) {
   }
 }
 
+TEST(get_test, get_presence) {
+  huzch::UserService_Stub stub(channel.get());
+  brpc::Controller ctrl;
+  huzch::GetPresenceReq req;
+  req.set_request_id(huzch::uuid());
+  req.set_user_id("d13c040f2fe60000");
+  req.add_users_id("1fe9a0b8d11a0000");
+  req.add_users_id("cb40be03c9f00000");
+  // 非好友的在线状态不予返回
+  std::string stranger_id = huzch::uuid();
+  req.add_users_id(stranger_id);
+  huzch::GetPresenceRsp rsp;
+
+  stub.GetPresence(&ctrl, &req, &rsp, nullptr);
+  ASSERT_FALSE(ctrl.Failed());
+  ASSERT_TRUE(rsp.success());
+  ASSERT_EQ(rsp.presence().size(), 2);
+  ASSERT_EQ(rsp.presence().count(stranger_id), 0);
+
+  for (auto& [user_id, online] : rsp.presence()) {
+    std::cout << user_id << " " << online << std::endl;
+  }
+}
+
 // TEST(set_test, set_name) {
 //   huzch::UserService_Stub stub(channel.get());
 //   brpc::Controller ctrl;
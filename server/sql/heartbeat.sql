@@ -0,0 +1,10 @@
+CREATE DATABASE IF NOT EXISTS `huzch`;
+USE `huzch`;
+DROP TABLE IF EXISTS `heartbeat`;
+
+/* 主库心跳，用于计算从库复制延迟 */
+CREATE TABLE `heartbeat` (
+  `id` TINYINT UNSIGNED NOT NULL PRIMARY KEY,
+  `ts` TIMESTAMP(6) NOT NULL)
+ ENGINE=InnoDB;
+
@@ -6,22 +6,45 @@ CREATE DATABASE IF NOT EXISTS `huzch`;
 USE `huzch`;
 DROP TABLE IF EXISTS `message`;
 
+/* 按create_time按月范围分区，分区键必须包含在主键中；初始只有pmax，
+ * 消息服务启动时由归档线程从当前月起预建分区，冷分区导出到分段文件后删除 */
 CREATE TABLE `message` (
-  `id` BIGINT UNSIGNED NOT NULL PRIMARY KEY AUTO_INCREMENT,
+  `id` BIGINT UNSIGNED NOT NULL AUTO_INCREMENT,
   `message_id` varchar(64) NOT NULL,
   `session_id` varchar(64) NOT NULL,
   `user_id` varchar(64) NOT NULL,
   `message_type` TINYINT UNSIGNED NOT NULL,
-  `create_time` timestamp NULL,
+  `create_time` timestamp NOT NULL,
+  `seq` BIGINT UNSIGNED NOT NULL,
   `content` TEXT NULL,
   `file_id` varchar(64) NULL,
   `file_name` varchar(64) NULL,
-  `file_size` INT UNSIGNED NULL)
- ENGINE=InnoDB;
+  `file_size` INT UNSIGNED NULL,
+  PRIMARY KEY (`id`, `create_time`))
+ ENGINE=InnoDB
+ PARTITION BY RANGE (UNIX_TIMESTAMP(`create_time`)) (
+  PARTITION `pmax` VALUES LESS THAN MAXVALUE);
+
+CREATE UNIQUE INDEX `message_id_create_time_i`
+  ON `message` (
+    `message_id`,
+    `create_time`);
 
-CREATE UNIQUE INDEX `message_id_i`
-  ON `message` (`message_id`);
+CREATE INDEX `session_id_create_time_i`
+  ON `message` (
+    `session_id`,
+    `create_time`);
 
-CREATE INDEX `session_id_i`
-  ON `message` (`session_id`);
+CREATE INDEX `session_id_seq_i`
+  ON `message` (
+    `session_id`,
+    `seq`);
 
+/* 会话已归档消息的最大序号，归档线程在删除分区前写入，
+ * 转发服务据此与message表一起恢复redis中丢失的序号计数器 */
+DROP TABLE IF EXISTS `message_seq`;
+
+CREATE TABLE `message_seq` (
+  `session_id` varchar(64) NOT NULL PRIMARY KEY,
+  `seq` BIGINT UNSIGNED NOT NULL)
+ ENGINE=InnoDB;
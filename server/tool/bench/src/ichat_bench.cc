@@ -0,0 +1,443 @@
+// 聊天链路端到端压测
+// 模拟 users 个用户经网关 http 接口注册、登录并建立 websocket 长连接，
+// 相邻两人组成单聊会话、每 group_size 人组成群聊会话；压测期间每个用户
+// 按 send_rate 向所属会话发送文本消息，按 history_rate 拉取历史消息。
+// 消息正文携带发送时刻，接收方收到推送时计算 发送->推送 的延迟
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <websocketpp/client.hpp>
+#include <websocketpp/config/asio_no_tls_client.hpp>
+
+#include "forward.pb.h"
+#include "friend.pb.h"
+#include "gateway.pb.h"
+#include "httplib.h"
+#include "message.pb.h"
+#include "notify.pb.h"
+#include "user.pb.h"
+#include "utils.hpp"
+
+#define USER_REGISTER "/service/user/user_register"
+#define USER_LOGIN "/service/user/user_login"
+#define GET_USER_INFO "/service/user/get_user_info"
+#define CHAT_SESSION_CREATE "/service/friend/chat_session_create"
+#define NEW_MESSAGE "/service/forward/new_message"
+#define GET_HISTORY_MESSAGE "/service/message/get_history_message"
+
+DEFINE_string(gateway_host, "127.0.0.1", "网关地址");
+DEFINE_int32(http_port, 9000, "网关http端口");
+DEFINE_int32(websocket_port, 9001, "网关websocket端口");
+
+DEFINE_int32(users, 100, "模拟用户数");
+DEFINE_string(user_prefix, "bench_", "模拟用户名前缀");
+DEFINE_string(password, "bench123", "模拟用户密码");
+DEFINE_int32(group_size, 5, "群聊会话人数");
+
+DEFINE_double(send_rate, 1.0, "每个用户每秒发送消息数");
+DEFINE_double(group_ratio, 0.5, "发往群聊会话的消息占比");
+DEFINE_double(history_rate, 0.2, "每个用户每秒拉取历史消息次数");
+DEFINE_int32(history_count, 20, "单次拉取的历史消息数");
+DEFINE_int32(duration, 30, "压测时长(秒)");
+DEFINE_int32(workers, 8, "发送请求的线程数");
+
+using namespace huzch;
+
+using WsClient = websocketpp::client<websocketpp::config::asio_client>;
+using Clock = std::chrono::steady_clock;
+
+static const std::string bench_tag = "bench:";
+
+static int64_t now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+// 延迟样本(微秒)，压测结束后统计分位数
+class Histogram {
+ public:
+  void add(int64_t us) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _samples.push_back(us);
+  }
+
+  void report(const std::string& name) {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_samples.empty()) {
+      LOG_INFO("{}: 无样本", name);
+      return;
+    }
+    std::sort(_samples.begin(), _samples.end());
+    auto at = [this](double q) {
+      size_t index = static_cast<size_t>(q * _samples.size());
+      return _samples[std::min(index, _samples.size() - 1)];
+    };
+    LOG_INFO("{}: count={} p50={}us p90={}us p99={}us p999={}us max={}us",
+             name, _samples.size(), at(0.5), at(0.9), at(0.99), at(0.999),
+             _samples.back());
+  }
+
+ private:
+  std::mutex _mutex;
+  std::vector<int64_t> _samples;
+};
+
+struct BenchUser {
+  std::string name;
+  std::string user_id;
+  std::string login_session_id;
+  std::string single_session;  // 单聊会话，人数为奇数时最后一人没有
+  std::string group_session;
+  size_t group_members = 0;
+  WsClient::connection_ptr connection;
+};
+
+struct BenchStats {
+  Histogram push_latency;     // 发送 -> 推送
+  Histogram send_latency;     // NewMessage 请求耗时
+  Histogram history_latency;  // GetHistoryMessage 请求耗时
+  std::atomic<size_t> sent{0};
+  std::atomic<size_t> send_failed{0};
+  std::atomic<size_t> expected{0};  // 应收到的推送数
+  std::atomic<size_t> pushed{0};
+  std::atomic<size_t> history{0};
+  std::atomic<size_t> history_failed{0};
+};
+
+template <typename Req, typename Rsp>
+static bool call(httplib::Client& client, const std::string& path, Req& req,
+                 Rsp& rsp) {
+  req.set_request_id(huzch::uuid());
+  auto res =
+      client.Post(path, req.SerializeAsString(), "application/protobuf");
+  if (!res || res->status != 200 || !rsp.ParseFromString(res->body)) {
+    return false;
+  }
+  return rsp.success();
+}
+
+// 注册(已存在时忽略失败)、登录并获取自身 user_id
+static bool login(httplib::Client& client, BenchUser& user) {
+  huzch::UserRegisterReq register_req;
+  huzch::UserRegisterRsp register_rsp;
+  register_req.set_user_name(user.name);
+  register_req.set_password(FLAGS_password);
+  call(client, USER_REGISTER, register_req, register_rsp);
+
+  huzch::UserLoginReq login_req;
+  huzch::UserLoginRsp login_rsp;
+  login_req.set_user_name(user.name);
+  login_req.set_password(FLAGS_password);
+  if (!call(client, USER_LOGIN, login_req, login_rsp)) {
+    LOG_ERROR("用户 {} 登录失败: {}", user.name, login_rsp.errmsg());
+    return false;
+  }
+  user.login_session_id = login_rsp.login_session_id();
+
+  huzch::GetUserInfoReq info_req;
+  huzch::GetUserInfoRsp info_rsp;
+  info_req.set_login_session_id(user.login_session_id);
+  if (!call(client, GET_USER_INFO, info_req, info_rsp)) {
+    LOG_ERROR("用户 {} 信息获取失败: {}", user.name, info_rsp.errmsg());
+    return false;
+  }
+  user.user_id = info_rsp.user_info().user_id();
+  return true;
+}
+
+static std::string create_session(httplib::Client& client,
+                                  const BenchUser& creator,
+                                  const std::string& name,
+                                  const std::vector<std::string>& members_id) {
+  huzch::ChatSessionCreateReq req;
+  huzch::ChatSessionCreateRsp rsp;
+  req.set_chat_session_name(name);
+  req.set_login_session_id(creator.login_session_id);
+  for (const auto& member_id : members_id) {
+    req.add_members_id(member_id);
+  }
+  if (!call(client, CHAT_SESSION_CREATE, req, rsp)) {
+    LOG_ERROR("会话 {} 创建失败: {}", name, rsp.errmsg());
+    return std::string();
+  }
+  return rsp.chat_session_info().chat_session_id();
+}
+
+// 相邻两人一个单聊会话，每 group_size 人一个群聊会话
+static bool create_sessions(httplib::Client& client,
+                            std::vector<BenchUser>& users) {
+  std::string run_id = huzch::uuid().substr(0, 8);
+  for (size_t i = 0; i + 1 < users.size(); i += 2) {
+    auto session_id =
+        create_session(client, users[i], "bench_single_" + run_id,
+                       {users[i].user_id, users[i + 1].user_id});
+    if (session_id.empty()) {
+      return false;
+    }
+    users[i].single_session = users[i + 1].single_session = session_id;
+  }
+
+  size_t group_size = std::max(FLAGS_group_size, 2);
+  for (size_t begin = 0; begin < users.size(); begin += group_size) {
+    size_t end = std::min(begin + group_size, users.size());
+    if (end - begin < 2) {
+      break;
+    }
+    std::vector<std::string> members_id;
+    for (size_t i = begin; i < end; ++i) {
+      members_id.push_back(users[i].user_id);
+    }
+    auto session_id = create_session(client, users[begin],
+                                     "bench_group_" + run_id, members_id);
+    if (session_id.empty()) {
+      return false;
+    }
+    for (size_t i = begin; i < end; ++i) {
+      users[i].group_session = session_id;
+      users[i].group_members = end - begin;
+    }
+  }
+  return true;
+}
+
+static void on_push(BenchStats& stats, WsClient::message_ptr message) {
+  huzch::NotifyMessage notify;
+  if (!notify.ParseFromString(message->get_payload()) ||
+      notify.notify_type() != huzch::NotifyType::CHAT_MESSAGE_NOTIFY) {
+    return;
+  }
+  const auto& content = notify.new_message_info()
+                            .message_info()
+                            .message()
+                            .string_message()
+                            .content();
+  if (content.compare(0, bench_tag.size(), bench_tag) != 0) {
+    return;
+  }
+  int64_t sent_us = std::stoll(content.substr(bench_tag.size()));
+  stats.push_latency.add(now_us() - sent_us);
+  ++stats.pushed;
+}
+
+// 建立长连接并鉴权，全部连接由同一个 asio 事件循环驱动
+static bool connect_all(WsClient& ws, std::vector<BenchUser>& users,
+                        BenchStats& stats) {
+  std::atomic<size_t> opened{0};
+  std::string uri = "ws://" + FLAGS_gateway_host + ":" +
+                    std::to_string(FLAGS_websocket_port);
+  for (auto& user : users) {
+    websocketpp::lib::error_code ec;
+    auto connection = ws.get_connection(uri, ec);
+    if (ec) {
+      LOG_ERROR("长连接创建失败: {}", ec.message());
+      return false;
+    }
+    std::string login_session_id = user.login_session_id;
+    connection->set_open_handler(
+        [&ws, &opened, login_session_id](websocketpp::connection_hdl hdl) {
+          huzch::ClientAuthenticationReq req;
+          req.set_request_id(huzch::uuid());
+          req.set_login_session_id(login_session_id);
+          ws.send(hdl, req.SerializeAsString(),
+                  websocketpp::frame::opcode::value::binary);
+          ++opened;
+        });
+    connection->set_message_handler(
+        [&stats](websocketpp::connection_hdl, WsClient::message_ptr message) {
+          on_push(stats, message);
+        });
+    ws.connect(connection);
+    user.connection = connection;
+  }
+
+  auto deadline = Clock::now() + std::chrono::seconds(10);
+  while (opened < users.size() && Clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  if (opened < users.size()) {
+    LOG_ERROR("长连接建立超时: {}/{}", opened.load(), users.size());
+    return false;
+  }
+  // 等待网关完成鉴权，避免首批消息被写入离线收件箱
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  return true;
+}
+
+static void send_message(httplib::Client& client, const BenchUser& user,
+                         BenchStats& stats) {
+  bool group = !user.group_session.empty() &&
+               (user.single_session.empty() ||
+                huzch::random64() % 1000 < FLAGS_group_ratio * 1000);
+
+  huzch::NewMessageReq req;
+  huzch::NewMessageRsp rsp;
+  req.set_chat_session_id(group ? user.group_session : user.single_session);
+  req.set_login_session_id(user.login_session_id);
+  req.mutable_message()->set_message_type(huzch::MessageType::STRING);
+  int64_t start = now_us();
+  req.mutable_message()->mutable_string_message()->set_content(
+      bench_tag + std::to_string(start));
+
+  if (!call(client, NEW_MESSAGE, req, rsp)) {
+    ++stats.send_failed;
+    return;
+  }
+  stats.send_latency.add(now_us() - start);
+  ++stats.sent;
+  stats.expected += group ? user.group_members - 1 : 1;
+}
+
+static void fetch_history(httplib::Client& client, const BenchUser& user,
+                          BenchStats& stats) {
+  huzch::GetHistoryMessageReq req;
+  huzch::GetHistoryMessageRsp rsp;
+  req.set_chat_session_id(user.group_session.empty() ? user.single_session
+                                                     : user.group_session);
+  req.set_login_session_id(user.login_session_id);
+  req.set_start_time(time(nullptr) - 3600);
+  req.set_end_time(time(nullptr));
+  req.set_msg_count(FLAGS_history_count);
+
+  int64_t start = now_us();
+  if (!call(client, GET_HISTORY_MESSAGE, req, rsp)) {
+    ++stats.history_failed;
+    return;
+  }
+  stats.history_latency.add(now_us() - start);
+  ++stats.history;
+}
+
+// 每个工作线程负责 index % workers == worker 的用户，按各自的速率定时发起请求；
+// 调度落后时立即补发，不因服务端变慢而降低发送速率
+static void run_worker(size_t worker, std::vector<BenchUser>& users,
+                       BenchStats& stats, Clock::time_point end) {
+  enum Kind { SEND, HISTORY };
+  using Event = std::tuple<Clock::time_point, size_t, Kind>;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+
+  auto interval = [](double rate) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+  };
+  auto jitter = [](Clock::duration period) {
+    return Clock::duration(huzch::random64() %
+                           std::max<int64_t>(period.count(), 1));
+  };
+
+  auto now = Clock::now();
+  for (size_t i = worker; i < users.size(); i += FLAGS_workers) {
+    if (users[i].single_session.empty() && users[i].group_session.empty()) {
+      continue;
+    }
+    if (FLAGS_send_rate > 0) {
+      events.emplace(now + jitter(interval(FLAGS_send_rate)), i, SEND);
+    }
+    if (FLAGS_history_rate > 0) {
+      events.emplace(now + jitter(interval(FLAGS_history_rate)), i, HISTORY);
+    }
+  }
+
+  httplib::Client client(FLAGS_gateway_host, FLAGS_http_port);
+  client.set_keep_alive(true);
+  while (!events.empty()) {
+    auto [due, index, kind] = events.top();
+    events.pop();
+    if (due >= end) {
+      continue;
+    }
+    std::this_thread::sleep_until(due);
+
+    if (kind == SEND) {
+      send_message(client, users[index], stats);
+      events.emplace(due + interval(FLAGS_send_rate), index, kind);
+    } else {
+      fetch_history(client, users[index], stats);
+      events.emplace(due + interval(FLAGS_history_rate), index, kind);
+    }
+  }
+}
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  huzch::init_logger(true, "", 0);
+
+  std::vector<BenchUser> users(FLAGS_users);
+  for (int i = 0; i < FLAGS_users; ++i) {
+    users[i].name = FLAGS_user_prefix + std::to_string(i);
+  }
+
+  // 准备阶段：并行登录，串行建会话
+  std::atomic<bool> ready{true};
+  std::vector<std::thread> threads;
+  for (int w = 0; w < FLAGS_workers; ++w) {
+    threads.emplace_back([&users, &ready, w]() {
+      httplib::Client client(FLAGS_gateway_host, FLAGS_http_port);
+      for (size_t i = w; i < users.size(); i += FLAGS_workers) {
+        if (!login(client, users[i])) {
+          ready = false;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+
+  httplib::Client client(FLAGS_gateway_host, FLAGS_http_port);
+  if (!ready || !create_sessions(client, users)) {
+    return -1;
+  }
+  LOG_INFO("{} 个用户登录完毕，会话创建完毕", users.size());
+
+  BenchStats stats;
+  WsClient ws;
+  ws.clear_access_channels(websocketpp::log::alevel::all);
+  ws.clear_error_channels(websocketpp::log::elevel::all);
+  ws.init_asio();
+  ws.start_perpetual();
+  std::thread ws_thread([&ws]() { ws.run(); });
+
+  if (!connect_all(ws, users, stats)) {
+    ws.stop();
+    ws_thread.join();
+    return -1;
+  }
+
+  LOG_INFO("开始压测: {} 秒", FLAGS_duration);
+  auto start = Clock::now();
+  auto end = start + std::chrono::seconds(FLAGS_duration);
+  for (int w = 0; w < FLAGS_workers; ++w) {
+    threads.emplace_back(run_worker, w, std::ref(users), std::ref(stats), end);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // 等待在途推送到达
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+
+  ws.stop_perpetual();
+  for (auto& user : users) {
+    websocketpp::lib::error_code ec;
+    user.connection->close(websocketpp::close::status::normal, "", ec);
+  }
+  ws_thread.join();
+
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  LOG_INFO("发送 {} 条(失败 {})，{:.1f} 条/秒", stats.sent.load(),
+           stats.send_failed.load(), stats.sent / seconds);
+  LOG_INFO("应推送 {} 次，实际 {} 次", stats.expected.load(),
+           stats.pushed.load());
+  LOG_INFO("拉取历史 {} 次(失败 {})", stats.history.load(),
+           stats.history_failed.load());
+  stats.push_latency.report("send->push");
+  stats.send_latency.report("new_message");
+  stats.history_latency.report("get_history_message");
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,304 @@
+// 会话分片在线迁移工具
+//
+// 迁移步骤:
+//   1. reshard -phase=copy，将归属发生变化的会话复制到新分片(服务仍使用旧分片列表)
+//   2. 滚动更新各服务的 -mysql_shards 为新分片列表
+//   3. 再次执行 reshard -phase=copy，补齐切换期间写入旧分片的数据
+//   4. reshard -phase=cleanup，删除旧分片上已迁出的会话
+// copy 阶段可重复执行，已存在的会话、成员、消息会被跳过
+// 分片列表中只需填写各分片主库地址，数据经主从复制同步到从库
+#include <gflags/gflags.h>
+
+#include <unordered_map>
+#include <unordered_set>
+
+#include "data_mysql_shard.hpp"
+#include "logger.hpp"
+#include "message-odb.hxx"
+#include "session-odb.hxx"
+#include "session_member-odb.hxx"
+
+DEFINE_bool(run_mode, true, "程序运行模式: true调试/false发布");
+DEFINE_string(log_file, "", "发布模式下日志文件");
+DEFINE_int32(log_level, 0, "发布模式下日志等级");
+
+DEFINE_string(mysql_user, "root", "mysql服务器用户名");
+DEFINE_string(mysql_passwd, "123456", "mysql服务器密码");
+DEFINE_string(mysql_db, "huzch", "mysql默认库名");
+DEFINE_string(mysql_charset, "utf8", "mysql客户端字符集");
+DEFINE_int32(mysql_max_connections, 2, "mysql连接池最大连接数量");
+DEFINE_int32(mysql_min_connections, 2, "mysql连接池启动时预热的连接数量");
+
+DEFINE_string(from_shards, "", "迁移前的分片地址列表(host:port,逗号分隔)");
+DEFINE_string(to_shards, "", "迁移后的分片地址列表(host:port,逗号分隔)");
+DEFINE_string(phase, "copy", "迁移阶段: copy复制/cleanup清理");
+DEFINE_int32(batch_size, 500, "每批读写的行数");
+
+namespace huzch {
+
+class Resharder {
+ public:
+  using DatabasePtr = std::shared_ptr<odb::core::database>;
+
+ public:
+  Resharder(const std::vector<std::string>& from_hosts,
+            const std::vector<std::string>& to_hosts, size_t batch_size)
+      : _from_hosts(from_hosts), _to_hosts(to_hosts), _batch_size(batch_size) {
+    for (const auto& host : _from_hosts) {
+      connect(host);
+    }
+    for (const auto& host : _to_hosts) {
+      connect(host);
+    }
+  }
+
+  bool copy() {
+    for (const auto& host : _from_hosts) {
+      size_t moved = 0;
+      bool ret = for_each_session(host, [&](const Session& session) {
+        const std::string& owner = this->owner(session.session_id());
+        if (owner == host) {
+          return true;
+        }
+        ++moved;
+        return copy_session(_databases[host], _databases[owner], session);
+      });
+      if (!ret) {
+        return false;
+      }
+      LOG_INFO("分片 {} 复制完毕，迁出 {} 个会话", host, moved);
+    }
+    return true;
+  }
+
+  bool cleanup() {
+    for (const auto& [host, db] : _databases) {
+      size_t removed = 0;
+      bool ret = for_each_session(host, [&](const Session& session) {
+        const std::string& owner = this->owner(session.session_id());
+        if (owner == host) {
+          return true;
+        }
+        // 目标分片上不存在该会话时说明尚未复制，保留数据
+        if (!exists(_databases[owner], session.session_id())) {
+          LOG_ERROR("会话 {} 未复制到分片 {}，跳过清理", session.session_id(),
+                    owner);
+          return true;
+        }
+        ++removed;
+        return remove_session(db, session.session_id());
+      });
+      if (!ret) {
+        return false;
+      }
+      LOG_INFO("分片 {} 清理完毕，移除 {} 个会话", host, removed);
+    }
+    return true;
+  }
+
+ private:
+  void connect(const std::string& host) {
+    if (_databases.count(host)) {
+      return;
+    }
+    auto hosts = MysqlClientFactory::parse(host);
+    _databases[host] = MysqlClientFactory::create(
+        FLAGS_mysql_user, FLAGS_mysql_passwd, FLAGS_mysql_db, hosts[0].first,
+        hosts[0].second, FLAGS_mysql_charset, FLAGS_mysql_max_connections,
+        FLAGS_mysql_min_connections);
+  }
+
+  const std::string& owner(const std::string& session_id) {
+    return _to_hosts[ShardedDatabase::index(session_id, _to_hosts.size())];
+  }
+
+  // 按主键分批遍历分片上的所有会话
+  template <typename F>
+  bool for_each_session(const std::string& host, F&& fn) {
+    auto& db = _databases[host];
+    unsigned long last_id = 0;
+    while (true) {
+      std::vector<Session> sessions;
+      try {
+        odb::transaction t(db->begin());
+        odb::query<Session> q(odb::query<Session>::id > last_id);
+        q += "ORDER BY" + odb::query<Session>::id + "LIMIT" +
+             odb::query<Session>::_val(_batch_size);
+        auto result = db->query<Session>(q);
+        for (const auto& session : result) {
+          sessions.push_back(session);
+        }
+        t.commit();
+      } catch (const std::exception& e) {
+        LOG_ERROR("分片 {} 遍历会话失败: {}", host, e.what());
+        return false;
+      }
+
+      for (const auto& session : sessions) {
+        if (!fn(session)) {
+          return false;
+        }
+      }
+      if (sessions.size() < _batch_size) {
+        return true;
+      }
+      last_id = sessions.back().id();
+    }
+  }
+
+  bool exists(const DatabasePtr& db, const std::string& session_id) {
+    try {
+      odb::transaction t(db->begin());
+      std::unique_ptr<Session> session(db->query_one<Session>(
+          odb::query<Session>::session_id == session_id));
+      t.commit();
+      return session != nullptr;
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 查询失败: {}", session_id, e.what());
+      return false;
+    }
+  }
+
+  // ODB 同一线程只允许一个活动事务，源端读与目标端写分开提交
+  bool copy_session(const DatabasePtr& src, const DatabasePtr& dst,
+                    const Session& session) {
+    std::string session_id = session.session_id();
+    try {
+      std::vector<SessionMember> src_members;
+      {
+        odb::transaction t(src->begin());
+        auto result = src->query<SessionMember>(
+            odb::query<SessionMember>::session_id == session_id);
+        for (const auto& member : result) {
+          src_members.push_back(member);
+        }
+        t.commit();
+      }
+
+      std::unordered_set<std::string> messages_id;
+      {
+        odb::transaction t(dst->begin());
+        std::unique_ptr<Session> dst_session(dst->query_one<Session>(
+            odb::query<Session>::session_id == session_id));
+        if (!dst_session) {
+          Session copy(session_id, session.session_name(),
+                       session.session_type());
+          dst->persist(copy);
+        }
+
+        std::unordered_set<std::string> users_id;
+        auto members = dst->query<SessionMember>(
+            odb::query<SessionMember>::session_id == session_id);
+        for (const auto& member : members) {
+          users_id.insert(member.user_id());
+        }
+        for (const auto& member : src_members) {
+          if (!users_id.count(member.user_id())) {
+            SessionMember copy(session_id, member.user_id());
+            dst->persist(copy);
+          }
+        }
+
+        auto messages =
+            dst->query<Message>(odb::query<Message>::session_id == session_id);
+        for (const auto& message : messages) {
+          messages_id.insert(message.message_id());
+        }
+        t.commit();
+      }
+
+      unsigned long last_id = 0;
+      while (true) {
+        std::vector<Message> batch;
+        {
+          odb::transaction t(src->begin());
+          odb::query<Message> q(odb::query<Message>::session_id == session_id &&
+                                odb::query<Message>::id > last_id);
+          q += "ORDER BY" + odb::query<Message>::id + "LIMIT" +
+               odb::query<Message>::_val(_batch_size);
+          auto result = src->query<Message>(q);
+          for (const auto& message : result) {
+            batch.push_back(message);
+          }
+          t.commit();
+        }
+
+        {
+          odb::transaction t(dst->begin());
+          for (auto& message : batch) {
+            if (!messages_id.count(message.message_id())) {
+              dst->persist(message);
+            }
+          }
+          t.commit();
+        }
+
+        if (batch.size() < _batch_size) {
+          break;
+        }
+        last_id = batch.back().id();
+      }
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 复制失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+  bool remove_session(const DatabasePtr& db, const std::string& session_id) {
+    try {
+      odb::transaction t(db->begin());
+      db->erase_query<Message>(odb::query<Message>::session_id == session_id);
+      db->erase_query<SessionMember>(odb::query<SessionMember>::session_id ==
+                                     session_id);
+      db->erase_query<Session>(odb::query<Session>::session_id == session_id);
+      t.commit();
+    } catch (const std::exception& e) {
+      LOG_ERROR("会话 {} 清理失败: {}", session_id, e.what());
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  std::vector<std::string> _from_hosts;
+  std::vector<std::string> _to_hosts;
+  size_t _batch_size;
+  std::unordered_map<std::string, DatabasePtr> _databases;
+};
+
+}  // namespace huzch
+
+using namespace huzch;
+
+static std::vector<std::string> split(const std::string& hosts) {
+  std::vector<std::string> result;
+  for (const auto& [host, port] : huzch::MysqlClientFactory::parse(hosts)) {
+    result.push_back(host + ":" + std::to_string(port));
+  }
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  huzch::init_logger(FLAGS_run_mode, FLAGS_log_file, FLAGS_log_level);
+
+  auto from_hosts = split(FLAGS_from_shards);
+  auto to_hosts = split(FLAGS_to_shards);
+  if (from_hosts.empty() || to_hosts.empty()) {
+    LOG_ERROR("未指定迁移前后的分片列表");
+    return -1;
+  }
+
+  huzch::Resharder resharder(from_hosts, to_hosts, FLAGS_batch_size);
+  bool ret = false;
+  if (FLAGS_phase == "copy") {
+    ret = resharder.copy();
+  } else if (FLAGS_phase == "cleanup") {
+    ret = resharder.cleanup();
+  } else {
+    LOG_ERROR("未知的迁移阶段 {}", FLAGS_phase);
+  }
+
+  return ret ? 0 : -1;
+}